@@ -0,0 +1,528 @@
+// Times the generator, the solver, the serial and parallel distance field
+// floods, the point to point searches, the tree index, the junction graph, the
+// analyzer, the BMP writer, the save and load commands and the file system
+// profiler over a matrix of maze settings, and writes one JSON or CSV record
+// per measurement so runs can be compared over time and between engines.
+//
+// Build from the top of the repository. game.c supplies the save and
+// load commands and leaves out its own main when MAZE_BENCH is defined:
+//   gcc -O2 -DMAZE_BENCH -Isrc bench/mazebench.c src/*.c -lpthread
+// Allocation counts need the allocator routed through this file, which
+// only the GNU linker can do. Without it they are reported as -1:
+//   -DBM_COUNT_ALLOCS -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+//   -Wl,--wrap=posix_memalign
+//
+// Usage: mazebench [-f json|csv] [-o file] [-r repeats]
+//                  [-m maxSize] [-p maxPrintSize]
+// Everything the game prints goes to the null device while it runs.
+// The save file is written to the current directory and removed after,
+// and the print step leaves maze.bmp behind just like the game does.
+#include "mazegen.h"
+#include "mazestats.h"
+#include "pathfind.h"
+#include "command.h"
+#include "filesystem.h"
+#include "threads.h"
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+#ifdef linux
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+#define BM_NULL_DEVICE "NUL"
+#else
+#define BM_NULL_DEVICE "/dev/null"
+#endif
+
+#define BM_SAVE_FILE "mazebench.sav"
+#define BM_SEED 0x4D415A45U // every case is carved from the same seeds
+#define BM_DEFAULT_REPEATS 3
+#define BM_DEFAULT_MAX_SIZE 1024
+#define BM_DEFAULT_MAX_PRINT 256 // a BMP is 192 bytes per cell
+#define BM_TREE_QUERIES 1000000 // counted as cells for tree_query
+
+typedef struct
+{
+  const char *name;
+  char bCentered;   // otherwise the waypoint is the top left cell
+  int alleyDivisor; // alleys are the maze size over this, 0 for none
+  double dirPercent;
+} bm_waypoint_t;
+
+// one point of the matrix, and the maze it is working on
+typedef struct
+{
+  int algorithm;
+  int size;
+  double straightProb;
+  const bm_waypoint_t *waypoint;
+  int alleyLen;
+  int rep;
+  maze_t *maze;
+} bm_case_t;
+
+typedef struct
+{
+  FILE *out;
+  char bCSV;
+  int numResults;
+  int repeats;
+} bm_report_t;
+
+typedef void(*bm_op_t)(bm_case_t *c);
+
+static const int sizes[] = { 16, 64, 256, 1024, 4096 };
+static const double straightProbs[] = { 0.0, 0.5, 0.9 };
+static const bm_waypoint_t waypoints[] =
+{
+  { "center", TRUE, 0, 0.2 },
+  { "center_alleys", TRUE, 4, 0.2 },
+  { "corner", FALSE, 0, 0.2 },
+};
+static const char *algorithms[] = { "joel", "kruskal", "tiled" };
+
+static char cwd[MAX_PATH];
+static pf_field_t *field; // reused by every flood, like a game would
+static pf_search_t *search; // and by every search
+static pf_tree_t *tree;     // and by every tree index
+static pf_graph_t *graph;   // and by every junction graph
+
+// from game.c
+void saveMaze();
+void loadMaze();
+void benchSetMaze(maze_t *newMaze);
+
+#ifdef BM_COUNT_ALLOCS
+static volatile int allocCount = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *block, size_t size);
+int __real_posix_memalign(void **block, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  th_AtomicIncrement(&allocCount);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+  th_AtomicIncrement(&allocCount);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *block, size_t size)
+{
+  th_AtomicIncrement(&allocCount);
+  return __real_realloc(block, size);
+}
+
+int __wrap_posix_memalign(void **block, size_t alignment, size_t size)
+{
+  th_AtomicIncrement(&allocCount);
+  return __real_posix_memalign(block, alignment, size);
+}
+#endif
+
+// monotonic time in nanoseconds
+static double bm_Now(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart * 1e9 / (double)frequency.QuadPart;
+#elif defined(linux)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+#else
+  return (double)clock() * 1e9 / CLOCKS_PER_SEC;
+#endif
+}
+
+// peak resident set size of the whole run so far in KiB, -1 if unknown
+static long bm_PeakRSS(void)
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+    sizeof(counters)))
+  {
+    return (long)(counters.PeakWorkingSetSize / 1024);
+  }
+#elif defined(linux)
+  struct rusage usage;
+  if (!getrusage(RUSAGE_SELF, &usage)) return usage.ru_maxrss;
+#endif
+  return -1;
+}
+
+static unsigned int bm_Allocs(void)
+{
+#ifdef BM_COUNT_ALLOCS
+  return (unsigned int)allocCount;
+#else
+  return 0;
+#endif
+}
+
+static void bm_Generate(bm_case_t *c)
+{
+  int way = c->waypoint->bCentered ? (c->size + 1) / 2 : 1;
+
+  mazeSeed(BM_SEED + c->rep);
+  c->maze = mazeGenerate(c->size, c->size, way, way, c->alleyLen,
+    c->waypoint->dirPercent, c->straightProb, FALSE);
+}
+
+static void bm_Solve(bm_case_t *c)
+{
+  (void)c;
+  mazeSolve();
+}
+
+static void bm_Flood(bm_case_t *c)
+{
+  pf_Flood(field, c->maze, c->maze->startX, c->maze->startY);
+}
+
+// the same flood on every core
+static void bm_FloodParallel(bm_case_t *c)
+{
+  pf_FloodParallel(field, c->maze, c->maze->startX, c->maze->startY, 0);
+}
+
+// the same start to exit question as bm_Flood, answered by each PF_SEARCH_*
+static void bm_SearchBFS(bm_case_t *c)
+{
+  pf_Search(search, c->maze, PF_SEARCH_BFS, c->maze->startX,
+    c->maze->startY, c->maze->endX, c->maze->endY);
+}
+
+static void bm_SearchAStar(bm_case_t *c)
+{
+  pf_Search(search, c->maze, PF_SEARCH_ASTAR, c->maze->startX,
+    c->maze->startY, c->maze->endX, c->maze->endY);
+}
+
+static void bm_SearchBidirectional(bm_case_t *c)
+{
+  pf_Search(search, c->maze, PF_SEARCH_BIDIRECTIONAL, c->maze->startX,
+    c->maze->startY, c->maze->endX, c->maze->endY);
+}
+
+// indexed by PF_SEARCH_*
+static const bm_op_t searchOps[] = { bm_SearchBFS, bm_SearchAStar,
+  bm_SearchBidirectional };
+static const char *searchNames[] = { "search_bfs", "search_astar",
+  "search_bidirectional" };
+
+static void bm_TreeBuild(bm_case_t *c)
+{
+  pf_TreeBuild(tree, c->maze, c->maze->startX, c->maze->startY);
+}
+
+// distances between cells picked by a fixed generator, so every run asks
+// the same questions
+static void bm_TreeQuery(bm_case_t *c)
+{
+  unsigned int r = BM_SEED;
+  int i, fromX, fromY;
+
+  for (i = 0; i < BM_TREE_QUERIES; i++)
+  {
+    fromX = (r = r * 1103515245U + 12345U) % c->size;
+    fromY = (r = r * 1103515245U + 12345U) % c->size;
+    r = r * 1103515245U + 12345U;
+    pf_TreeDistance(tree, fromX, fromY, r % c->size, (r >> 16) % c->size);
+  }
+}
+
+static void bm_GraphBuild(bm_case_t *c)
+{
+  pf_GraphBuild(graph, c->maze);
+}
+
+// start to exit again, over the graph bm_GraphBuild left
+static void bm_GraphSearch(bm_case_t *c)
+{
+  pf_GraphSearch(graph, c->maze, c->maze->startX, c->maze->startY,
+    c->maze->endX, c->maze->endY);
+}
+
+static void bm_Analyze(bm_case_t *c)
+{
+  ms_stats_t stats;
+
+  ms_Analyze(c->maze, &stats);
+}
+
+static void bm_Print(bm_case_t *c)
+{
+  (void)c;
+  mazePrint();
+}
+
+static void bm_Save(bm_case_t *c)
+{
+  (void)c;
+  cmd_AddToBuffer("save " BM_SAVE_FILE);
+  cmd_ExecuteCommands();
+}
+
+static void bm_Load(bm_case_t *c)
+{
+  (void)c;
+  cmd_AddToBuffer("load " BM_SAVE_FILE);
+  cmd_ExecuteCommands();
+}
+
+static void bm_Profile(bm_case_t *c)
+{
+  (void)c;
+  fs_ProfileCWD();
+}
+
+// the profiler only runs once per directory, so point it back at it
+static void bm_ResetCWD(bm_case_t *c)
+{
+  (void)c;
+  fs_SetCWD(cwd);
+}
+
+static void bm_WriteResult(bm_report_t *report, const char *op,
+  const bm_case_t *c, double cells, double bestNs, double totalNs,
+  long long allocs)
+{
+  const char *algorithm = c ? algorithms[c->algorithm] : "";
+  const char *waypoint = c ? c->waypoint->name : "";
+  int size = c ? c->size : 0;
+  int alleyLen = c ? c->alleyLen : 0;
+  double straightProb = c ? c->straightProb : 0.0;
+  double nsPerCell = bestNs / cells;
+  double cellsPerSec = bestNs > 0.0 ? cells * 1e9 / bestNs : 0.0;
+
+  if (report->bCSV)
+  {
+    if (!report->numResults)
+    {
+      fprintf(report->out, "op,algorithm,width,height,straight_prob,"
+        "waypoint,alley_len,repeats,cells,best_ns,mean_ns,ns_per_cell,"
+        "cells_per_sec,allocs,peak_rss_kb\n");
+    }
+    fprintf(report->out, "%s,%s,%d,%d,%.2f,%s,%d,%d,%.0f,%.0f,%.0f,"
+      "%.3f,%.0f,%lld,%ld\n", op, algorithm, size, size, straightProb,
+      waypoint, alleyLen, report->repeats, cells, bestNs,
+      totalNs / report->repeats, nsPerCell, cellsPerSec, allocs,
+      bm_PeakRSS());
+  }
+  else
+  {
+    fprintf(report->out, "%s\n  {\"op\": \"%s\", \"algorithm\": \"%s\", "
+      "\"width\": %d, \"height\": %d, \"straight_prob\": %.2f, "
+      "\"waypoint\": \"%s\", \"alley_len\": %d, \"repeats\": %d, "
+      "\"cells\": %.0f, \"best_ns\": %.0f, \"mean_ns\": %.0f, "
+      "\"ns_per_cell\": %.3f, \"cells_per_sec\": %.0f, \"allocs\": %lld, "
+      "\"peak_rss_kb\": %ld}", report->numResults ? "," : "[", op,
+      algorithm, size, size, straightProb, waypoint, alleyLen,
+      report->repeats, cells, bestNs, totalNs / report->repeats,
+      nsPerCell, cellsPerSec, allocs, bm_PeakRSS());
+  }
+  fflush(report->out);
+  report->numResults++;
+}
+
+// Runs op report->repeats times, with prepare (if any) run untimed before
+// each one, and records the best and mean. Allocations are per run.
+static void bm_Time(bm_report_t *report, const char *name, bm_op_t op,
+  bm_op_t prepare, bm_case_t *c, double cells)
+{
+  double bestNs = 0.0, totalNs = 0.0, start, ns;
+  unsigned int allocs = 0, before;
+  int i;
+
+  for (i = 0; i < report->repeats; i++)
+  {
+    if (c) c->rep = i;
+    if (prepare) prepare(c);
+
+    before = bm_Allocs();
+    start = bm_Now();
+    op(c);
+    ns = bm_Now() - start;
+    allocs += bm_Allocs() - before;
+
+    totalNs += ns;
+    if (!i || ns < bestNs) bestNs = ns;
+  }
+
+#ifdef BM_COUNT_ALLOCS
+  bm_WriteResult(report, name, c, cells, bestNs, totalNs,
+    allocs / report->repeats);
+#else
+  bm_WriteResult(report, name, c, cells, bestNs, totalNs, -1);
+#endif
+}
+
+static void bm_RunCase(bm_report_t *report, bm_case_t *c, int maxPrint)
+{
+  double cells = (double)c->size * c->size;
+  int i;
+
+  bm_Time(report, "generate", bm_Generate, NULL, c, cells);
+  if (!c->maze)
+  {
+    fprintf(stderr, "mazeGenerate failed for %s %dx%d, skipping\n",
+      algorithms[c->algorithm], c->size, c->size);
+    return;
+  }
+  bm_Time(report, "solve", bm_Solve, NULL, c, cells);
+  if (field)
+  {
+    bm_Time(report, "flood", bm_Flood, NULL, c, cells);
+    bm_Time(report, "flood_parallel", bm_FloodParallel, NULL, c, cells);
+  }
+  for (i = 0; search && i < PF_NUM_SEARCHES; i++)
+  {
+    bm_Time(report, searchNames[i], searchOps[i], NULL, c, cells);
+  }
+  if (tree)
+  {
+    bm_Time(report, "tree_build", bm_TreeBuild, NULL, c, cells);
+    bm_Time(report, "tree_query", bm_TreeQuery, NULL, c, BM_TREE_QUERIES);
+  }
+  if (graph)
+  {
+    bm_Time(report, "graph_build", bm_GraphBuild, NULL, c, cells);
+    bm_Time(report, "graph_search", bm_GraphSearch, NULL, c, cells);
+  }
+  bm_Time(report, "analyze", bm_Analyze, NULL, c, cells);
+  if (c->size > maxPrint) return;
+
+  bm_Time(report, "print", bm_Print, NULL, c, cells);
+  benchSetMaze(c->maze);
+  bm_Time(report, "save", bm_Save, NULL, c, cells);
+  // the load command only finds files the profiler has seen
+  bm_ResetCWD(c);
+  fs_ProfileCWD();
+  bm_Time(report, "load", bm_Load, NULL, c, cells);
+}
+
+static void bm_Usage(void)
+{
+  fprintf(stderr, "Use format mazebench [-f json|csv] [-o file] "
+    "[-r repeats] [-m maxSize] [-p maxPrintSize]\n");
+}
+
+int main(int argc, char **argv)
+{
+  bm_report_t report;
+  bm_case_t c;
+  const char *path = NULL;
+  int maxSize = BM_DEFAULT_MAX_SIZE, maxPrint = BM_DEFAULT_MAX_PRINT;
+  int i, a, s, p, w;
+
+  memset(&report, 0, sizeof(report));
+  report.repeats = BM_DEFAULT_REPEATS;
+  for (i = 1; i < argc; i++)
+  {
+    if (i + 1 == argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+    {
+      bm_Usage();
+      return 1;
+    }
+
+    switch (argv[i][1])
+    {
+    case 'f': report.bCSV = !strcmp(argv[++i], "csv"); break;
+    case 'o': path = argv[++i]; break;
+    case 'r': report.repeats = atoi(argv[++i]); break;
+    case 'm': maxSize = atoi(argv[++i]); break;
+    case 'p': maxPrint = atoi(argv[++i]); break;
+    default:
+      bm_Usage();
+      return 1;
+    }
+  }
+  if (report.repeats < 1) report.repeats = 1;
+  if (!path) path = report.bCSV ? "mazebench.csv" : "mazebench.json";
+
+  report.out = fopen(path, "w");
+  if (!report.out)
+  {
+    fprintf(stderr, "ERROR - could not open %s\n", path);
+    return 1;
+  }
+
+#ifdef _WIN32
+  GetCurrentDirectoryA(MAX_PATH, cwd);
+#endif
+#ifdef linux
+  if (!getcwd(cwd, MAX_PATH)) cwd[0] = 0;
+#endif
+  if (!freopen(BM_NULL_DEVICE, "w", stdout))
+  {
+    fprintf(stderr, "ERROR - could not silence the output\n");
+    return 1;
+  }
+
+  cmd_Init();
+  fs_Init();
+  cmd_AddCommand("save", saveMaze);
+  cmd_AddCommand("load", loadMaze);
+  field = pf_Create();
+  search = pf_SearchCreate();
+  tree = pf_TreeCreate();
+  graph = pf_GraphCreate();
+
+  // one directory, counted as one cell
+  bm_Time(&report, "profile_cwd", bm_Profile, bm_ResetCWD, NULL, 1.0);
+
+  memset(&c, 0, sizeof(c));
+  for (a = 0; a < (int)(sizeof(algorithms) / sizeof(algorithms[0])); a++)
+  {
+    c.algorithm = a;
+    mazeSetAlgorithm(mazeFindAlgorithm(algorithms[a]));
+    for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+      if (sizes[s] > maxSize) break;
+      c.size = sizes[s];
+      for (w = 0; w < (int)(sizeof(waypoints) / sizeof(waypoints[0])); w++)
+      {
+        c.waypoint = &waypoints[w];
+        c.alleyLen = c.waypoint->alleyDivisor ?
+          c.size / c.waypoint->alleyDivisor : 0;
+        for (p = 0; p < (int)(sizeof(straightProbs) /
+          sizeof(straightProbs[0])); p++)
+        {
+          c.straightProb = straightProbs[p];
+          bm_RunCase(&report, &c, maxPrint);
+        }
+      }
+    }
+  }
+
+  if (!report.bCSV) fprintf(report.out, "\n]\n");
+  fclose(report.out);
+  remove(BM_SAVE_FILE);
+  pf_Free(field);
+  pf_SearchFree(search);
+  pf_TreeFree(tree);
+  pf_GraphFree(graph);
+
+  cmd_Shutdown();
+  fs_Shutdown();
+  mazeFree();
+  fprintf(stderr, "Wrote %d results to %s\n", report.numResults, path);
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,297 @@
+#include "bitplane.h"
+#include <stdlib.h>
+#include <string.h>
+// SSE2 is always there on x64, AVX2 only when the compiler is told so
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BP_AVX2
+#define BP_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BP_SSE2
+#endif
+
+#define BP_VECTOR_WORDS 4 // words in the widest vector (AVX2)
+#define BP_MASK_BITS 16   // bytes read per SSE2 load in bp_LoadMaze
+
+static int bp_Popcount(bp_word_t word)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(word);
+#else
+  word = word - ((word >> 1) & 0x5555555555555555ULL);
+  word = (word & 0x3333333333333333ULL) +
+    ((word >> 2) & 0x3333333333333333ULL);
+  word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// ORs the low bits of mask into the row starting at bit pos
+static void bp_OrBits(bp_word_t *row, int pos, bp_word_t mask)
+{
+  int shift = pos & 63;
+
+  row[pos >> 6] |= mask << shift;
+  if (shift) row[(pos >> 6) + 1] |= mask >> (BP_WORD_BITS - shift);
+}
+
+// spreads the low 16 bits out to every other bit
+static bp_word_t bp_Spread(bp_word_t bits)
+{
+  bits = (bits | bits << 8) & 0x00FF00FFULL;
+  bits = (bits | bits << 4) & 0x0F0F0F0FULL;
+  bits = (bits | bits << 2) & 0x33333333ULL;
+  return (bits | bits << 1) & 0x55555555ULL;
+}
+
+bitplane_t *bp_Create(int width, int height)
+{
+  bitplane_t *bp;
+  int i;
+
+  bp = (bitplane_t*)calloc(1, sizeof(bitplane_t));
+  if (!bp) return NULL;
+
+  // the border adds a column on each side, and a whole extra word
+  // leaves room for bp_OrBits to reach past the last cell
+  bp->width = width;
+  bp->height = height;
+  bp->rowWords = (width + 2) / BP_WORD_BITS + 1;
+  bp->rowWords = (bp->rowWords + BP_VECTOR_WORDS - 1) / BP_VECTOR_WORDS *
+    BP_VECTOR_WORDS;
+  bp->planeWords = (size_t)bp->rowWords * (height + 2);
+
+  bp->planes[0] = (bp_word_t*)calloc(bp->planeWords * BP_NUM_PLANES,
+    sizeof(bp_word_t));
+  if (!bp->planes[0])
+  {
+    free(bp);
+    return NULL;
+  }
+  for (i = 1; i < BP_NUM_PLANES; i++)
+  {
+    bp->planes[i] = bp->planes[0] + bp->planeWords * i;
+  }
+
+  return bp;
+}
+
+void bp_Free(bitplane_t *bp)
+{
+  if (!bp) return;
+
+  free(bp->planes[0]);
+  free(bp);
+}
+
+void bp_Clear(bitplane_t *bp, int plane)
+{
+  memset(bp->planes[plane], 0, bp->planeWords * sizeof(bp_word_t));
+}
+
+void bp_LoadMaze(bitplane_t *bp, const maze_t *maze)
+{
+  int i, x, y, shift;
+  int step = maze->bPacked ? 2 : 1;
+  uint8 cell;
+  bp_word_t occupied, north, east, south, west;
+  bp_word_t *n, *e, *s, *w, *o;
+  size_t word;
+
+  for (i = 0; i < BP_NUM_PLANES; i++)
+  {
+    bp_Clear(bp, i);
+  }
+
+  for (y = 0; y < maze->height; y++)
+  {
+    x = 0;
+#ifdef BP_SSE2
+    // 16 bytes at a time: each wall bit is shifted up to the top of its
+    // byte, where movemask gathers it. Reading past the end of the row
+    // is fine, the border and padding are part of the block.
+    const __m128i walls = _mm_set1_epi8(BITSLICE_0x0F);
+    const __m128i zero = _mm_setzero_si128();
+
+    if (maze->bPacked)
+    {
+      // the even and odd columns are gathered apart and then interleaved
+      for (; x < maze->width; x += 2 * BP_MASK_BITS)
+      {
+        __m128i pairs = _mm_loadu_si128((const __m128i*)
+          &MAZE_PACKED(maze, x, y));
+        __m128i even = _mm_and_si128(walls, pairs);
+        __m128i odd = _mm_and_si128(walls, _mm_srli_epi16(pairs, 4));
+        bp_word_t keep = maze->width - x >= 2 * BP_MASK_BITS ?
+          0xFFFFFFFFULL : (1ULL << (maze->width - x)) - 1;
+
+        bp_OrBits(BP_ROW(bp, BP_OCCUPIED, y), x + 1, keep & ~(
+          bp_Spread(_mm_movemask_epi8(_mm_cmpeq_epi8(even, zero))) |
+          bp_Spread(_mm_movemask_epi8(_mm_cmpeq_epi8(odd, zero))) << 1));
+        for (i = 0; i < TOTAL_DIRECTIONS; i++)
+        {
+          bp_OrBits(BP_ROW(bp, BP_NORTH + i, y), x + 1, keep &
+            (bp_Spread(_mm_movemask_epi8(_mm_slli_epi16(even, 7 - i))) |
+            bp_Spread(_mm_movemask_epi8(_mm_slli_epi16(odd, 7 - i))) << 1));
+        }
+      }
+    }
+    else
+    {
+      for (; x < maze->width; x += BP_MASK_BITS)
+      {
+        __m128i cells = _mm_and_si128(walls,
+          _mm_loadu_si128((const __m128i*)&MAZE_CELL(maze, x, y)));
+        bp_word_t keep = maze->width - x >= BP_MASK_BITS ? 0xFFFF :
+          (1U << (maze->width - x)) - 1;
+
+        bp_OrBits(BP_ROW(bp, BP_OCCUPIED, y), x + 1, keep &
+          ~(bp_word_t)_mm_movemask_epi8(_mm_cmpeq_epi8(cells, zero)));
+        for (i = 0; i < TOTAL_DIRECTIONS; i++)
+        {
+          bp_OrBits(BP_ROW(bp, BP_NORTH + i, y), x + 1, keep &
+            (bp_word_t)_mm_movemask_epi8(_mm_slli_epi16(cells, 7 - i)));
+        }
+      }
+    }
+#endif
+    // everything else a byte at a time, gathered into whole words. A
+    // packed byte is two cells, and the high nibble of the last one is
+    // the border when the width is odd.
+    occupied = north = east = south = west = 0;
+    for (; x < maze->width; x += step)
+    {
+      if (!maze->bPacked) cell = MAZE_CELL(maze, x, y) & BITSLICE_0x0F;
+      else if (x + 1 < maze->width) cell = MAZE_PACKED(maze, x, y);
+      else cell = MAZE_PACKED(maze, x, y) & BITSLICE_0x0F;
+
+      shift = x & 63;
+      occupied |= (bp_word_t)(((cell & BITSLICE_0x0F) != 0) |
+        (cell >> 4 != 0) << 1) << shift;
+      north |= (bp_word_t)((cell & 1) | (cell >> 3 & 2)) << shift;
+      east |= (bp_word_t)((cell >> 1 & 1) | (cell >> 4 & 2)) << shift;
+      south |= (bp_word_t)((cell >> 2 & 1) | (cell >> 5 & 2)) << shift;
+      west |= (bp_word_t)((cell >> 3 & 1) | (cell >> 6 & 2)) << shift;
+
+      if (shift + step > 63 || x + step >= maze->width)
+      {
+        bp_OrBits(BP_ROW(bp, BP_OCCUPIED, y), x - shift + 1, occupied);
+        bp_OrBits(BP_ROW(bp, BP_NORTH, y), x - shift + 1, north);
+        bp_OrBits(BP_ROW(bp, BP_EAST, y), x - shift + 1, east);
+        bp_OrBits(BP_ROW(bp, BP_SOUTH, y), x - shift + 1, south);
+        bp_OrBits(BP_ROW(bp, BP_WEST, y), x - shift + 1, west);
+        occupied = north = east = south = west = 0;
+      }
+    }
+  }
+
+  // The start and exit open through the border, which leads nowhere, so
+  // those openings are dropped the same way ms_Analyze drops them. A cell
+  // is occupied if any opening is left.
+  memset(BP_ROW(bp, BP_NORTH, 0), 0, bp->rowWords * sizeof(bp_word_t));
+  memset(BP_ROW(bp, BP_SOUTH, bp->height - 1), 0,
+    bp->rowWords * sizeof(bp_word_t));
+  for (y = 0; y < bp->height; y++)
+  {
+    BP_ROW(bp, BP_WEST, y)[0] &= ~(1ULL << 1);
+    BP_ROW(bp, BP_EAST, y)[bp->width >> 6] &= ~(1ULL << (bp->width & 63));
+  }
+  n = bp->planes[BP_NORTH];
+  e = bp->planes[BP_EAST];
+  s = bp->planes[BP_SOUTH];
+  w = bp->planes[BP_WEST];
+  o = bp->planes[BP_OCCUPIED];
+  for (word = 0; word < bp->planeWords; word++)
+  {
+    o[word] = n[word] | e[word] | s[word] | w[word];
+  }
+}
+
+long long bp_CountDeadEnds(const bitplane_t *bp)
+{
+  const bp_word_t *n = bp->planes[BP_NORTH];
+  const bp_word_t *e = bp->planes[BP_EAST];
+  const bp_word_t *s = bp->planes[BP_SOUTH];
+  const bp_word_t *w = bp->planes[BP_WEST];
+  long long count = 0;
+  size_t i = 0;
+
+  // a dead end has an opening but no two of them at once
+#if defined(BP_AVX2)
+  bp_word_t lanes[BP_VECTOR_WORDS];
+
+  for (; i < bp->planeWords; i += BP_VECTOR_WORDS)
+  {
+    __m256i vn = _mm256_loadu_si256((const __m256i*)(n + i));
+    __m256i ve = _mm256_loadu_si256((const __m256i*)(e + i));
+    __m256i vs = _mm256_loadu_si256((const __m256i*)(s + i));
+    __m256i vw = _mm256_loadu_si256((const __m256i*)(w + i));
+    __m256i any = _mm256_or_si256(_mm256_or_si256(vn, ve),
+      _mm256_or_si256(vs, vw));
+    __m256i two = _mm256_or_si256(
+      _mm256_and_si256(vn, _mm256_or_si256(ve, _mm256_or_si256(vs, vw))),
+      _mm256_or_si256(_mm256_and_si256(ve, _mm256_or_si256(vs, vw)),
+        _mm256_and_si256(vs, vw)));
+
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_andnot_si256(two, any));
+    count += bp_Popcount(lanes[0]) + bp_Popcount(lanes[1]) +
+      bp_Popcount(lanes[2]) + bp_Popcount(lanes[3]);
+  }
+#elif defined(BP_SSE2)
+  bp_word_t lanes[2];
+
+  for (; i < bp->planeWords; i += 2)
+  {
+    __m128i vn = _mm_loadu_si128((const __m128i*)(n + i));
+    __m128i ve = _mm_loadu_si128((const __m128i*)(e + i));
+    __m128i vs = _mm_loadu_si128((const __m128i*)(s + i));
+    __m128i vw = _mm_loadu_si128((const __m128i*)(w + i));
+    __m128i any = _mm_or_si128(_mm_or_si128(vn, ve), _mm_or_si128(vs, vw));
+    __m128i two = _mm_or_si128(
+      _mm_and_si128(vn, _mm_or_si128(ve, _mm_or_si128(vs, vw))),
+      _mm_or_si128(_mm_and_si128(ve, _mm_or_si128(vs, vw)),
+        _mm_and_si128(vs, vw)));
+
+    _mm_storeu_si128((__m128i*)lanes, _mm_andnot_si128(two, any));
+    count += bp_Popcount(lanes[0]) + bp_Popcount(lanes[1]);
+  }
+#endif
+  for (; i < bp->planeWords; i++)
+  {
+    bp_word_t two = (n[i] & (e[i] | s[i] | w[i])) | (e[i] & (s[i] | w[i])) |
+      (s[i] & w[i]);
+    count += bp_Popcount((n[i] | e[i] | s[i] | w[i]) & ~two);
+  }
+
+  return count;
+}
+
+void bp_MaskBytes(uint8 *bytes, size_t count, uint8 mask)
+{
+  size_t i = 0;
+
+#if defined(BP_AVX2)
+  const __m256i wide = _mm256_set1_epi8((char)mask);
+
+  for (; i + 32 <= count; i += 32)
+  {
+    _mm256_storeu_si256((__m256i*)(bytes + i), _mm256_and_si256(wide,
+      _mm256_loadu_si256((const __m256i*)(bytes + i))));
+  }
+#endif
+#ifdef BP_SSE2
+  const __m128i narrow = _mm_set1_epi8((char)mask);
+
+  for (; i + 16 <= count; i += 16)
+  {
+    _mm_storeu_si128((__m128i*)(bytes + i), _mm_and_si128(narrow,
+      _mm_loadu_si128((const __m128i*)(bytes + i))));
+  }
+#endif
+  for (; i < count; i++)
+  {
+    bytes[i] &= mask;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef BP_BITPLANE_H
+#define BP_BITPLANE_H
+
+#include <stddef.h>
+#include "mazegen.h"
+
+// planes held by a bitplane_t
+#define BP_OCCUPIED 0 // cells with any opening
+#define BP_NORTH 1
+#define BP_EAST 2
+#define BP_SOUTH 3
+#define BP_WEST 4
+#define BP_NUM_PLANES 5
+
+#define BP_WORD_BITS 64
+
+typedef unsigned long long bp_word_t;
+
+// One bit per cell for each plane, in row order, so whole rows can be
+// worked on 64 cells (or one vector) at a time. Every plane has an empty
+// one cell border around the maze, cell x, y is bit x + 1 of row y + 1,
+// and rows are padded to a whole number of vectors.
+typedef struct
+{
+  int width, height;
+  int rowWords; // words from one row to the next
+  size_t planeWords;
+  bp_word_t *planes[BP_NUM_PLANES];
+} bitplane_t;
+
+#define BP_ROW(bp, plane, y) \
+  ((bp)->planes[plane] + (ptrdiff_t)((y) + 1) * (bp)->rowWords)
+#define BP_TEST(bp, plane, x, y) \
+  (BP_ROW(bp, plane, y)[((x) + 1) >> 6] >> (((x) + 1) & 63) & 1)
+#define BP_SET(bp, plane, x, y) \
+  (BP_ROW(bp, plane, y)[((x) + 1) >> 6] |= 1ULL << (((x) + 1) & 63))
+
+bitplane_t *bp_Create(int width, int height); // returns NULL on failure
+void bp_Free(bitplane_t *bp);
+void bp_Clear(bitplane_t *bp, int plane);
+// Loads the openings of a maze the same size as bp. Like ms_Analyze it
+// only keeps the ones that lead to another cell, so the start and exit
+// do not open through the border.
+void bp_LoadMaze(bitplane_t *bp, const maze_t *maze);
+
+long long bp_CountDeadEnds(const bitplane_t *bp); // cells with one opening
+
+void bp_MaskBytes(uint8 *bytes, size_t count, uint8 mask); // ANDs each byte
+
+#endif // BP_BITPLANE_H
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include "utility.h"
 #include "input.h"
 #include "mazegen.h"
+#include "mazepool.h"
+#include "mazestats.h"
+#include "pathfind.h"
 #include "filesystem.h"
 #include <time.h>
 #ifdef linux
@@ -11,6 +14,7 @@
 #define MAX_MENU_SELECTIONS 3
 #define MAX_VIEW_DIST 2 // used for CHALLENGE_MODE
 #define CHALLENGE_HEIGHT 26
+#define LAZY_LOOKAHEAD 16 // giant levels are carved this far past the view
 
 typedef struct
 {
@@ -32,11 +36,29 @@ static boolean_t bEnterPressed = _FALSE;
 static boolean_t bIsChallenge = _FALSE;
 static char currSelection = 0;
 static maze_t *maze = NULL;
+static maze_lazy_t *lazyMaze = NULL; // a giant level, played instead of maze
+static pf_field_t *exitField = NULL; // distances to the exit, see printPath
+static pf_hints_t *hints = NULL; // the way out of maze, see readyHints
+static boolean_t bHintsReady = _FALSE; // hints is for the current maze
+static boolean_t bShowPath = _FALSE; // overlay the way out on the maze
+static uint8 *pathBits = NULL; // cells on the overlaid path, see printMaze
+static size_t pathBytes = 0;
 static player_t player;
 static keyStates_t keys;
 
+// the New Game choices, which the maze pool keeps ready (see presets)
+#define PRESET_NORMAL 0
+#define PRESET_CHALLENGE 1
+
 void saveMaze();
 void loadMaze();
+void streamMaze();
+void challengeMaze();
+void printStats();
+void printPath();
+void printHint();
+void toggleOverlay();
+void setAlgorithm();
 void openConsole();
 void closeConsole();
 char *readInput();
@@ -44,15 +66,23 @@ void printMenu();
 void endProgram();
 void k_EnterDown();
 
+// the openings of a cell in whichever maze is being played
+uint8 getMazeCell(int x, int y)
+{
+  if (lazyMaze) return mazeLazyGet(lazyMaze, x, y);
+  return MAZE_GET(maze, x, y) & BITSLICE_0x0F;
+}
+
 // _TRUE if there is a pathing error
 boolean_t checkForPathingError(int x, int y, char direction)
 {
-  if (!checkBounds(x, y))
+  if (lazyMaze ? x < 0 || y < 0 || x >= lazyMaze->width ||
+    y >= lazyMaze->height : !checkBounds(x, y))
   {
     //printf("Out of bounds!\n");
     return _TRUE;
   }
-  else if (!(maze->data[player.currX][player.currY] &
+  else if (!(getMazeCell(player.currX, player.currY) &
              DIRECTION_LIST[direction]))
   {
     //printf("Path blocked!\n");
@@ -187,21 +217,20 @@ void k_EnterDown()
 {
   if (bEnterPressed && bMenuIsActive) // already pressed
   {
+    mazeLazyFree(lazyMaze);
+    lazyMaze = NULL;
     switch (currSelection)
     {
     case 0:
-      mazeFree();
       bIsChallenge = _FALSE;
-      maze = mazeGenerate(25, 25, 12, 12, 4, 0.2, 0.5, FALSE);
+      maze = mp_Take(PRESET_NORMAL);
       break;
     case 1: // serves as challenge mode
-      mazeFree();
       bIsChallenge = _TRUE;
-      // the height of CHALLENGE_HEIGHT is important - it lets the load
-      // function determine if the game was in Challenge mode or not
-      maze = mazeGenerate(25, CHALLENGE_HEIGHT, 12, 12, 4, 0.2, 0.5, FALSE);
+      maze = mp_Take(PRESET_CHALLENGE);
       break;
     }
+    bHintsReady = _FALSE;
     player.newX = maze->startX;
     player.newY = maze->startY;
 
@@ -251,6 +280,13 @@ void gameInit()
   cmd_AddCommand("dup", k_DUp);
   cmd_AddCommand("save", saveMaze);
   cmd_AddCommand("load", loadMaze);
+  cmd_AddCommand("stream", streamMaze);
+  cmd_AddCommand("challenge", challengeMaze);
+  cmd_AddCommand("stats", printStats);
+  cmd_AddCommand("path", printPath);
+  cmd_AddCommand("hint", printHint);
+  cmd_AddCommand("overlay", toggleOverlay);
+  cmd_AddCommand("algorithm", setAlgorithm);
   cmd_AddCommand("cdown", openConsole);
   cmd_AddCommand("cup", closeConsole);
   cmd_AddCommand("enter", k_EnterDown);
@@ -288,7 +324,9 @@ void checkForUpdate()
     player.currY = player.newY;
     bNeedsUpdate = _TRUE;
   }
-  if (player.currX == maze->endX &&
+  if (lazyMaze ? player.currX == lazyMaze->endX &&
+      player.currY == lazyMaze->endY :
+      player.currX == maze->endX &&
       player.currY == maze->endY)
   {
     printf("You solved the maze!\n");
@@ -305,6 +343,12 @@ void saveMaze()
     return;
   }
 
+  if (lazyMaze)
+  {
+    printf("ERROR - giant challenge levels can not be saved\n");
+    return;
+  }
+
   char *arg = cmd_GetArg(0);
   fileHandle_t file = fs_Open(arg, "w");
   array_t arr;
@@ -354,7 +398,7 @@ void saveMaze()
       fprintf(f, "%c ", 'm');
       fprintf(f, "%d ", x); // x-coord
       fprintf(f, "%d ", y); // y-coord
-      fprintf(f, "%d", maze->data[x][y] & BITSLICE_0x0F);
+      fprintf(f, "%d", MAZE_GET(maze, x, y) & BITSLICE_0x0F);
       fprintf(f, "\n");
     }
   }
@@ -365,6 +409,177 @@ void saveMaze()
   clearData(&arr);
 }
 
+// writes a maze too big to play straight to disk, a row at a time
+void streamMaze()
+{
+  if (cmd_GetNumArgs() != 3)
+  {
+    printf("Use format stream maze.ext width height\n");
+    return;
+  }
+
+  // each cmd_GetArg call frees the string the last one returned
+  int width = atoi(cmd_GetArg(1));
+  int height = atoi(cmd_GetArg(2));
+  char *arg = cmd_GetArg(0);
+  if (!mazeStreamToFile(arg, width, height, 0.5))
+  {
+    printf("ERROR - could not stream a %d x %d maze to %s\n", width, height,
+      arg);
+    return;
+  }
+  printf("Wrote a %d x %d maze to %s\n", width, height, arg);
+}
+
+// Starts a fog of war level of any size up to MAZE_STREAM_MAX_SIZE. Only
+// the chunks around the player are ever carved, so it starts at once and
+// only takes memory for the part that has been explored.
+void challengeMaze()
+{
+  if (cmd_GetNumArgs() != 2)
+  {
+    printf("Use format challenge width height\n");
+    return;
+  }
+
+  int width = atoi(cmd_GetArg(0));
+  int height = atoi(cmd_GetArg(1));
+  maze_lazy_t *newMaze = mazeLazyCreate(width, height,
+    (unsigned int)time(NULL));
+  if (!newMaze)
+  {
+    printf("ERROR - could not make a %d x %d challenge\n", width, height);
+    return;
+  }
+
+  mazeLazyFree(lazyMaze);
+  lazyMaze = newMaze;
+  bHintsReady = _FALSE;
+  bIsChallenge = _TRUE;
+  player.newX = lazyMaze->startX;
+  player.newY = lazyMaze->startY;
+  bNeedsUpdate = _TRUE; // the player may already be on that cell
+  bMenuIsActive = _FALSE;
+  bEnterPressed = _FALSE;
+}
+
+// prints the numbers used to tune the New Game settings
+void printStats()
+{
+  ms_stats_t stats;
+
+  if (!maze || lazyMaze)
+  {
+    printf("ERROR - start or load a game first\n");
+    return;
+  }
+
+  if (!ms_Analyze(maze, &stats))
+  {
+    printf("ERROR - could not find the solution\n");
+  }
+  ms_Print(&stats);
+}
+
+// Floods the maze out from the exit on every core, which gives the
+// distance to it from everywhere at once. The field is kept, so only the
+// first flood of a maze this size allocates.
+void printPath()
+{
+  if (!maze || lazyMaze)
+  {
+    printf("ERROR - start or load a game first\n");
+    return;
+  }
+
+  if (!exitField) exitField = pf_Create();
+  if (!exitField ||
+    !pf_FloodParallel(exitField, maze, maze->endX, maze->endY, 0))
+  {
+    printf("ERROR - out of memory\n");
+    return;
+  }
+
+  printf("The exit is %lld steps away, the shortest solution is %lld\n",
+    pf_Distance(exitField, player.currX, player.currY),
+    pf_Distance(exitField, maze->startX, maze->startY));
+}
+
+// Packs the way out of every cell once per maze, so a hint or a step
+// along the overlay is a single lookup however big the maze is.
+boolean_t readyHints()
+{
+  if (bHintsReady) return _TRUE;
+
+  if (!hints) hints = pf_HintsCreate();
+  if (!exitField) exitField = pf_Create();
+  if (!hints || !exitField ||
+    !pf_FloodParallel(exitField, maze, maze->endX, maze->endY, 0) ||
+    !pf_HintsBuild(hints, exitField))
+  {
+    printf("ERROR - out of memory\n");
+    return _FALSE;
+  }
+  if (pf_Distance(exitField, maze->startX, maze->startY) < 0)
+  {
+    printf("ERROR - there is no way out of this maze\n");
+    return _FALSE;
+  }
+
+  bHintsReady = _TRUE;
+  return _TRUE;
+}
+
+// tells the player which way to step toward the exit
+void printHint()
+{
+  const char *names[] = { "up (W)", "right (D)", "down (S)", "left (A)" };
+
+  if (!maze || lazyMaze)
+  {
+    printf("ERROR - start or load a game first\n");
+    return;
+  }
+  if (!readyHints()) return;
+
+  int way = pf_HintWay(hints, player.currX, player.currY);
+  if (way < 0) printf("You are already at the exit\n");
+  else printf("Go %s\n", names[way]);
+}
+
+// shows or hides the way from the player to the exit on the maze
+void toggleOverlay()
+{
+  if (!maze || lazyMaze)
+  {
+    printf("ERROR - start or load a game first\n");
+    return;
+  }
+
+  bShowPath = !bShowPath;
+  bNeedsUpdate = _TRUE;
+}
+
+// picks the generator used for the next new game
+void setAlgorithm()
+{
+  if (cmd_GetNumArgs() != 1)
+  {
+    printf("Use format algorithm joel|kruskal|tiled\n");
+    return;
+  }
+
+  char *arg = cmd_GetArg(0);
+  int algorithm = mazeFindAlgorithm(arg);
+  if (algorithm == INVALID)
+  {
+    printf("ERROR - unknown algorithm %s\n", arg);
+    return;
+  }
+  mazeSetAlgorithm(algorithm);
+  mp_SetAlgorithm(algorithm);
+}
+
 void loadMaze()
 {
   if (cmd_GetNumArgs() != 1)
@@ -384,6 +599,9 @@ void loadMaze()
   }
   fs_ReadFile(file, &buffer);
   mazeFree(); // prevent leaks
+  mazeLazyFree(lazyMaze);
+  lazyMaze = NULL;
+  bHintsReady = _FALSE;
   bIsChallenge = _FALSE; // set this to _FALSE initially - may change
 
   int i;
@@ -489,7 +707,7 @@ void loadMaze()
         {
           char *str = arrayToChar(&temp);
           char c = atoi(str); // should be safe by now
-          maze->data[x][y] = c & BITSLICE_0x0F;
+          MAZE_SET(maze, x, y, c & BITSLICE_0x0F);
           free(str);
           clearData(&temp);
           break;
@@ -503,9 +721,86 @@ void loadMaze()
   bMenuIsActive = _FALSE;
 }
 
+// Giant levels only draw the cells in view, after carving a little past
+// them so the next few steps never wait on the generator.
+void printLazyMaze()
+{
+  int x, y;
+
+  if (!mazeLazyReveal(lazyMaze,
+    player.currX - MAX_VIEW_DIST - LAZY_LOOKAHEAD,
+    player.currY - MAX_VIEW_DIST - LAZY_LOOKAHEAD,
+    player.currX + MAX_VIEW_DIST + LAZY_LOOKAHEAD,
+    player.currY + MAX_VIEW_DIST + LAZY_LOOKAHEAD))
+  {
+    printf("ERROR - out of memory, the level is only partly carved\n");
+  }
+
+  for (y = player.currY - MAX_VIEW_DIST; y <= player.currY + MAX_VIEW_DIST;
+    y++)
+  {
+    for (x = player.currX - MAX_VIEW_DIST;
+      x <= player.currX + MAX_VIEW_DIST; x++)
+    {
+#ifdef linux
+      if (x == player.currX && y == player.currY) textcolor(32);
+      else if (x == lazyMaze->endX && y == lazyMaze->endY) textcolor(31);
+#endif
+      // cells outside the maze have no openings, so they draw solid
+      printf("%c", pipeList[getMazeCell(x, y)]);
+#ifdef linux
+      textcolor(37);
+#endif
+    }
+    printf("\n");
+  }
+  printf("At %d, %d of %d x %d, the exit is at %d, %d\n", player.currX,
+    player.currY, lazyMaze->width, lazyMaze->height, lazyMaze->endX,
+    lazyMaze->endY);
+  printf("\n");
+}
+
+// Marks the cells from the player to the exit in pathBits by following
+// the hints, one lookup a step. Returns FALSE if there is nothing to show.
+boolean_t markPath()
+{
+  size_t bytes = ((size_t)maze->width * maze->height + 7) / 8;
+  size_t steps = (size_t)maze->width * maze->height;
+  int x = player.currX, y = player.currY, way;
+
+  if (!readyHints()) return _FALSE;
+  if (bytes > pathBytes)
+  {
+    uint8 *bits = (uint8*)realloc(pathBits, bytes);
+    if (!bits) return _FALSE;
+    pathBits = bits;
+    pathBytes = bytes;
+  }
+  memset(pathBits, 0, bytes);
+
+  // a cell cut off from the exit has no way out, so stop after every cell
+  while ((way = pf_HintWay(hints, x, y)) >= 0 && steps--)
+  {
+    x += DIRECTION_DX[way];
+    y += DIRECTION_DY[way];
+    size_t cell = (size_t)y * maze->width + x;
+    pathBits[cell >> 3] |= (uint8)(1 << (cell & 7));
+  }
+  return _TRUE;
+}
+
 void printMaze()
 {
   int x, y;
+  size_t cell;
+
+  if (lazyMaze)
+  {
+    printLazyMaze();
+    return;
+  }
+
+  if (bShowPath && !markPath()) bShowPath = _FALSE;
 
   for (y = 0; y < maze->height; y++)
   {
@@ -514,6 +809,8 @@ void printMaze()
 #ifdef linux
       if (x == player.currX && y == player.currY) textcolor(32);
       else if (x == maze->endX && y == maze->endY) textcolor(31);
+      else if (bShowPath && (cell = (size_t)y * maze->width + x,
+        pathBits[cell >> 3] & (1 << (cell & 7)))) textcolor(33);
 #endif
       // if it is challenge mode and the location is
       // further than MAX_VIEW_DIST, draw it as a space
@@ -524,7 +821,7 @@ void printMaze()
       {
         printf(" ");
       }
-      else printf("%c", pipeList[maze->data[x][y] & BITSLICE_0x0F]);
+      else printf("%c", pipeList[getMazeCell(x, y)]);
 #ifdef linux
       textcolor(37);
 #endif
@@ -592,11 +889,28 @@ void printMenu()
   }
 }
 
+#ifdef MAZE_BENCH
+// bench/mazebench.c has its own main and hands its mazes over here so it
+// can time the save and load commands
+void benchSetMaze(maze_t *newMaze)
+{
+  maze = newMaze;
+  bHintsReady = _FALSE;
+}
+#else
+// handed to the maze pool by main, in PRESET_* order
+static const maze_params_t presets[] =
+{
+  { 25, 25, 12, 12, 4, 0.2, 0.5, 0, FALSE, MAZE_ALGO_JOEL },
+  // the height of CHALLENGE_HEIGHT is important - it lets the load
+  // function determine if the game was in Challenge mode or not
+  { 25, CHALLENGE_HEIGHT, 12, 12, 4, 0.2, 0.5, 0, FALSE, MAZE_ALGO_JOEL },
+};
+
 int main(int argc, char** argv)
 {
   int i = 0;
   char cwd[MAX_PATH];
-  srand((unsigned)time(NULL)); // seed the RNG
 
   //maze = mazeGenerate(25, 25, 12, 12, 4, 0.2, 0.5, FALSE);
   //if (!maze) return -1;
@@ -614,6 +928,7 @@ int main(int argc, char** argv)
   fs_SetCWD(&cwd[0]);
 #endif
   fs_ProfileCWD();
+  mp_Init(presets, sizeof(presets) / sizeof(presets[0]));
   printMenu();
 
   while (!bShouldClose)
@@ -633,7 +948,13 @@ int main(int argc, char** argv)
   cmd_Shutdown();
   i_Shutdown();
   fs_Shutdown();
+  mp_Shutdown();
   mazeFree();
+  mazeLazyFree(lazyMaze);
+  pf_Free(exitField);
+  pf_HintsFree(hints);
+  free(pathBits);
 
   return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -12,7 +12,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <limits.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 #include "mazegen.h"
+#include "threads.h"
+#include "bitplane.h"
 
 #define MAZEIII
 
@@ -20,13 +27,66 @@
 #include "BMP_ImageWriter.h"
 #endif
 
-#define MAX_STACK 173000
 #define MAX_RAND_SETS 32
 #define NUM_DIRECTIONS 4
 #define INVALID -1
 #define BMP_HEADER 54
 #define MIN(x, y) (x < y ? x : y)
-#define GOSTRAIGHT(pcent) (pcent > (double)rand()/(double)RAND_MAX)
+#define GOSTRAIGHT(ctx) (ctxRand(ctx) < ctx->straightLimit)
+#define RANDOM_SET_INDEX(ctx) (ctxRandRange(ctx, MAX_RAND_SETS / \
+  NUM_DIRECTIONS) * NUM_DIRECTIONS)
+#define PCG_MULTIPLIER 6364136223846793005ULL
+#define PCG_STREAM 1442695040888963407ULL
+#define MIN_FRAMES 1024
+#define MIN_TRACE_EVENTS 4096
+// maze_t and its cells share one block. The cells are surrounded by a
+// border of sentinel cells: one row above and below, and MAZE_ROW_ALIGN
+// bytes in front of every row so that column 0 stays aligned.
+#define MAZE_ALIGNMENT 64
+#define MAZE_ROW_ALIGN 16
+#define MAZE_HEADER_SIZE ((sizeof(maze_t) + MAZE_ALIGNMENT - 1) / \
+  MAZE_ALIGNMENT * MAZE_ALIGNMENT)
+#define MAZE_BLOCK_SIZE(stride, height) (MAZE_HEADER_SIZE + \
+  (size_t)(stride) * ((height) + 2))
+#define MAZE_CELLS_OFFSET(stride) (MAZE_HEADER_SIZE + (size_t)(stride) + \
+  MAZE_ROW_ALIGN)
+#define BORDER_CELL(maze) ((maze)->bPacked ? BITSLICE_0x0F : SPECIAL)
+#define NUM_PROBES 5
+#define BMP_CELL_BYTES 192 // 8x8 pixels, 3 bytes each
+#define FLAG_BIT(index) (1 << ((index) & 7))
+// Tiles carved in parallel by carveTiled. Even, so that no two tiles
+// of a packed maze share a byte.
+#define MAZE_TILE_SIZE 256
+#define TILE_SEED_STEP 0x9E3779B9U // spreads tile indices over the seeds
+// Lazy mazes are carved in square chunks as they are looked at. Each
+// kind of decision hashes the seed with its own salt.
+#define LAZY_CHUNK_SIZE 64
+#define LAZY_MIN_TABLE 64 // chunk table slots, always a power of two
+#define LAZY_SALT_CARVE 0 // seed of a chunk's own Kruskal carve
+#define LAZY_SALT_TREE 1  // which neighbor a chunk joins
+#define LAZY_SALT_DOOR 2  // where along the side the join is
+#define LAZY_SALT_ENDS 3  // start and exit columns
+#define LAZY_SALT_SLOT 4  // where a chunk goes in the table
+
+// frame types for the generation stack
+#define FRAME_FILL 0   // fills every reachable cell
+#define FRAME_CARVE 1  // carves from an alley for cellsLeft cells
+#define FRAME_ALLEYS 2 // loops over the remaining alleys
+#define FRAME_SOLVE 3  // depth first search used by mazeSolve
+#define FRAME_WALK 4   // walks the finished tree out from the waypoint
+
+// Sides of the waypoint a cell can hang off, see placeExit. Cells in
+// different branches are only joined through the waypoint.
+#define BRANCH_WAY 4    // the waypoint itself, 0 to 3 index DIRECTION_LIST
+#define NUM_BRANCHES 5
+#define BRANCH_NONE 0xFF // edge cell that has not been carved yet
+
+// stages a frame moves through while it is on the stack
+#define STAGE_ENTER 0
+#define STAGE_LOOP 1
+#define STAGE_RESULT 2
+#define STAGE_EXHAUSTED 3
+#define STAGE_RETURN 4
 
 const int DIRECTION_LIST[] = { NORTH, EAST, SOUTH, WEST };
 const int DIRECTION_DX[] = { 0, 1, 0, -1 };
@@ -40,25 +100,9 @@ const unsigned char pipeList[] =
 };
 
 const int DIRECTION_MAP[] = { SOUTH, WEST, NORTH, EAST };
-char rand_alleys[4];
-char alleymap_X[4];
-char alleymap_Y[4];
-
-static uint8 randomSets[MAX_RAND_SETS];
-static int numVisited = 0;
-static int mWidth;
-static int mHeight;
-static short currX;
-static short currY;
-static int numCells;
-static char alleyIndex = 0;
-static int recursionLevel = 0;
-static char bFoundWay = 0;
-static char bFoundExit = 0;
-static char bCallSolve = 1;
 
 #ifdef MAZEIII
-unsigned char header[54] =
+const unsigned char header[54] =
 {
   'B', 'M',  // magic number
   0, 0, 0, 0,  // size in bytes (set below)
@@ -77,20 +121,565 @@ unsigned char header[54] =
   0, 0, 0, 0,  // #important colors
 };
 
+// One row of cells worth of the .bmp image. mazePrint draws the maze a
+// row at a time into it, so the image never has to be held in full.
 typedef struct
 {
-  uint8 *image; // for .bmp image
+  uint8 *image; // the strip, pixelHeight rows of pixels
   int imgFileSize;
   int pixelWidth;
   int pixelHeight;
   int rowSize;
+  int stripSize;
   int pixelDataSize;
 } bmp_image_t;
+#endif
+
+typedef struct
+{
+  short x, y;
+  char direction;
+  char index; // first element of randomSets used by this frame
+  char pass;  // 0 = check adjacent cells, 1 = fill anything left
+  char k;     // next direction to try
+  char type;
+  char stage;
+  char branch; // BRANCH_* of the cell, generation frames only
+  char reach;  // TRUE if the subtree holds an edge cell, walks only
+} genFrame_t;
+
+// Everything a single generation needs. Nothing in this file touches
+// state outside of the context it is handed, so separate contexts can
+// be used from separate threads.
+struct maze_gen_ctx_s
+{
+  maze_t *maze;
+  uint8 randomSets[MAX_RAND_SETS];
+  char rand_alleys[4];
+  short alleymap_X[4];
+  short alleymap_Y[4];
+  int mWidth;
+  int mHeight;
+  short currX;
+  short currY;
+  int numCells;
+  int alleyIndex;
+  int cellsLeft;
+  char bFoundWay;
+  char bFoundExit;
+  char bSeeded; // nextSeed was set by mazeCtxSeed
+  char bQuiet;  // skip the allocation debug output
+  char bPacked; // allocate packed mazes (see mazeCtxSetPacked)
+  char algorithm; // MAZE_ALGO_* used by mazeGenerate_Ctx
+  int numThreads; // threads used by MAZE_ALGO_TILED, 0 = one per core
+  unsigned int nextSeed;
+  unsigned long long randState; // PCG32 state
+  unsigned long long randInc;   // PCG32 stream, 0 until first seeded
+  unsigned long long straightLimit; // GOSTRAIGHT threshold
+  genFrame_t *frameStack;
+  int frameTop;
+  int frameCapacity;
+  char bStackFailed; // pushFrame could not grow the stack
+  // VISITED and GOAL of the last maze generated or solved, one bit per
+  // cell in row order, so the maze's own cells only ever hold walls
+  uint8 *visitedBits;
+  uint8 *goalBits;
+  size_t flagBytes;
+  int flagWidth; // width of the maze the flags belong to
+  // cell offsets looked at by checkAdjacent, for each direction
+  int probe[NUM_DIRECTIONS][NUM_PROBES];
+  // Kruskal's sets (one per cell) and edges (two per cell)
+  int *sets;
+  unsigned int *edges;
+  size_t setCells;
+  // BRANCH_* of every cell on the edge of the maze (see edgeSlot)
+  uint8 *edgeBranches;
+  int edgeSlots;
+  // for the cells in line with the waypoint (see lineIndex), the step
+  // that reached each one on the last walk and its subtree's reach
+  char *lineParents;
+  char *lineReach;
+  // where carve events go (see mazeCtxSetTrace), and the trace that
+  // printAlgorithmSteps records into when the caller did not set one
+  maze_trace_t *trace;
+  maze_trace_t *stepTrace;
+};
+
+// A generation engine. carve fills in the whole maze and returns FALSE
+// if it runs out of memory.
+typedef struct
+{
+  const char *name;
+  int(*carve)(maze_gen_ctx_t *ctx);
+} mazeAlgorithm_t;
+
+// used by the original (context free) entry points
+static maze_gen_ctx_t defaultCtx;
+
+// one carved chunk of a lazy maze
+typedef struct
+{
+  long long key; // chunk index + 1, 0 for an empty slot
+  uint8 *cells;  // LAZY_CHUNK_SIZE cells to a row, walls only
+} lazyChunk_t;
+
+// the part of a lazy maze its users do not see
+struct maze_chunks_s
+{
+  maze_gen_ctx_t *ctx; // carves one chunk at a time
+  lazyChunk_t *table;  // open addressing, linear probing
+  int tableSize;
+  lazyChunk_t *last;   // the chunk looked at last, usually the next one
+  int chunksX, chunksY;
+};
+
+// Work shared by the threads of one mazeGenerateBatch call. Workers
+// claim maze indices from next, so the order they finish in does not
+// matter - every maze is built from its own seed.
+typedef struct
+{
+  const maze_params_t *params;
+  int count;
+  char bSeedRange; // one parameter set, seeds firstSeed + index
+  unsigned int firstSeed;
+  maze_t **mazes;
+  volatile int next;
+} mazeBatch_t;
+
+// Work shared by the threads of one carveTiled call. Workers claim
+// tiles from next, and count the ones they finish in done.
+typedef struct
+{
+  maze_t *maze;
+  int tilesX, tilesY;
+  unsigned int seed; // mixed with the tile index for each tile's seed
+  volatile int next;
+  volatile int done;
+  maze_trace_t *trace; // only set when a single thread does every tile
+} mazeTiles_t;
+
+// where mazeStreamToFile_Ctx is writing to
+typedef struct
+{
+  FILE *file;
+  uint8 *packed; // one row, two cells per byte
+} mazeStreamFile_t;
+
+/*************************************************************/
+/*size_t size:                                               */
+/*  in,                                                      */
+/*  number of bytes to allocate.                             */
+/*Returns a block aligned to MAZE_ALIGNMENT bytes, or NULL.  */
+/*Blocks from this function must be freed with alignedFree.  */
+/*************************************************************/
+void *alignedAlloc(size_t size)
+{
+#ifdef _WIN32
+  return _aligned_malloc(size, MAZE_ALIGNMENT);
+#else
+  void *block;
+  if (posix_memalign(&block, MAZE_ALIGNMENT, size)) return NULL;
+  return block;
+#endif
+}
 
-static bmp_image_t *mazeImg = NULL;
+/*************************************************************/
+/*void *block:                                               */
+/*  in,                                                      */
+/*  block returned by alignedAlloc,                          */
+/*  can be NULL.                                             */
+/*No return.                                                 */
+/*************************************************************/
+void alignedFree(void *block)
+{
+#ifdef _WIN32
+  _aligned_free(block);
+#else
+  free(block);
 #endif
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in,                                                      */
+/*  generation context to read from,                         */
+/*  must have a maze.                                        */
+/*int x:                                                     */
+/*  in,                                                      */
+/*  x position in the maze,                                  */
+/*  must be in bounds.                                       */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  y position in the maze,                                  */
+/*  must be in bounds.                                       */
+/*Returns the cell's walls along with its VISITED and GOAL   */
+/*  flags, the same way an unpacked cell used to store them. */
+/*The generator and solver only see cells through getCell,   */
+/*  orCell and xorCell. The walls come from the maze and the */
+/*  flags from the context's side bitsets, for both layouts, */
+/*  so the maze itself never holds scratch data and solving  */
+/*  it never writes to it.                                   */
+/*************************************************************/
+uint8 getCell(maze_gen_ctx_t *ctx, int x, int y)
+{
+  maze_t *maze = ctx->maze;
+  size_t index = (size_t)y * maze->width + x;
+  uint8 cell = MAZE_GET(maze, x, y);
+
+  if (ctx->visitedBits[index >> 3] & FLAG_BIT(index)) cell |= VISITED;
+  if (ctx->goalBits[index >> 3] & FLAG_BIT(index)) cell |= GOAL;
+
+  return cell;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to write to,                          */
+/*  must have a maze.                                        */
+/*int x:                                                     */
+/*  in,                                                      */
+/*  x position in the maze,                                  */
+/*  must be in bounds.                                       */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  y position in the maze,                                  */
+/*  must be in bounds.                                       */
+/*uint8 bits:                                                */
+/*  in,                                                      */
+/*  walls and flags to set,                                  */
+/*  SPECIAL is ignored for packed mazes.                     */
+/*No return.                                                 */
+/*The maze is only written to when bits holds walls, so      */
+/*  setting flags is safe while other threads read it.       */
+/*************************************************************/
+void orCell(maze_gen_ctx_t *ctx, int x, int y, uint8 bits)
+{
+  maze_t *maze = ctx->maze;
+  uint8 walls = bits & ~(VISITED | GOAL);
+  size_t index = (size_t)y * maze->width + x;
+
+  if (walls && maze->bPacked)
+  {
+    MAZE_PACKED(maze, x, y) |= (walls & BITSLICE_0x0F) <<
+      MAZE_NIBBLE_SHIFT(x);
+  }
+  else if (walls) MAZE_CELL(maze, x, y) |= walls;
+  if (bits & VISITED) ctx->visitedBits[index >> 3] |= FLAG_BIT(index);
+  if (bits & GOAL) ctx->goalBits[index >> 3] |= FLAG_BIT(index);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to write to,                          */
+/*  must have a maze.                                        */
+/*int x:                                                     */
+/*  in,                                                      */
+/*  x position in the maze,                                  */
+/*  must be in bounds.                                       */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  y position in the maze,                                  */
+/*  must be in bounds.                                       */
+/*uint8 bits:                                                */
+/*  in,                                                      */
+/*  walls and flags to toggle,                               */
+/*  SPECIAL is ignored for packed mazes.                     */
+/*No return.                                                 */
+/*************************************************************/
+void xorCell(maze_gen_ctx_t *ctx, int x, int y, uint8 bits)
+{
+  maze_t *maze = ctx->maze;
+  uint8 walls = bits & ~(VISITED | GOAL);
+  size_t index = (size_t)y * maze->width + x;
+
+  if (walls && maze->bPacked)
+  {
+    MAZE_PACKED(maze, x, y) ^= (walls & BITSLICE_0x0F) <<
+      MAZE_NIBBLE_SHIFT(x);
+  }
+  else if (walls) MAZE_CELL(maze, x, y) ^= walls;
+  if (bits & VISITED) ctx->visitedBits[index >> 3] ^= FLAG_BIT(index);
+  if (bits & GOAL) ctx->goalBits[index >> 3] ^= FLAG_BIT(index);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context that is recording,                    */
+/*  must have a maze and a trace.                            */
+/*int x, int y:                                              */
+/*  in,                                                      */
+/*  cell the event is about,                                 */
+/*  must be in bounds.                                       */
+/*int kind:                                                  */
+/*  in,                                                      */
+/*  MAZE_EVENT_OPEN, MAZE_EVENT_CLOSE or MAZE_EVENT_MARK.    */
+/*int direction:                                             */
+/*  in,                                                      */
+/*  index into DIRECTION_LIST of the wall.                   */
+/*No return.                                                 */
+/*This function appends one event to the context's trace.    */
+/*  The buffer doubles when it is full, so recording costs   */
+/*  the same at every step. If it can not grow the trace is  */
+/*  marked as failed and the rest of the carve goes          */
+/*  unrecorded, which never stops the maze itself.           */
+/*************************************************************/
+void traceEvent(maze_gen_ctx_t *ctx, int x, int y, int kind, int direction)
+{
+  maze_trace_t *trace = ctx->trace;
+  unsigned int *events;
+  size_t capacity;
+
+  if (trace->bFailed) return;
+  if (trace->numEvents == trace->capacity)
+  {
+    capacity = trace->capacity ? trace->capacity * 2 : MIN_TRACE_EVENTS;
+    events = (unsigned int*)realloc(trace->events,
+      capacity * sizeof(unsigned int));
+    if (!events)
+    {
+      trace->bFailed = TRUE;
+      return;
+    }
+    trace->events = events;
+    trace->capacity = capacity;
+  }
+
+  trace->events[trace->numEvents++] = MAZE_EVENT((size_t)y *
+    ctx->maze->width + x, kind, direction);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to write to,                          */
+/*  must have a maze.                                        */
+/*int x, int y:                                              */
+/*  in,                                                      */
+/*  cell to carve from,                                      */
+/*  must be in bounds.                                       */
+/*int direction:                                             */
+/*  in,                                                      */
+/*  index into DIRECTION_LIST of the wall to open,           */
+/*  must lead to a cell in bounds.                           */
+/*No return.                                                 */
+/*This function opens the wall between a cell and its        */
+/*  neighbor from both sides, and records it if the          */
+/*  context has a trace.                                     */
+/*************************************************************/
+void carveWall(maze_gen_ctx_t *ctx, int x, int y, int direction)
+{
+  orCell(ctx, x, y, DIRECTION_LIST[direction]);
+  orCell(ctx, x + DIRECTION_DX[direction], y + DIRECTION_DY[direction],
+    DIRECTION_MAP[direction]);
+  if (ctx->trace) traceEvent(ctx, x, y, MAZE_EVENT_OPEN, direction);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*int width, int height:                                     */
+/*  in,                                                      */
+/*  size of the maze the flags are for,                      */
+/*  must be between 3 and MAZE_MAX_SIZE.                     */
+/*Returns TRUE, or FALSE if the bitsets could not be grown.  */
+/*This function makes sure the side bitsets holding VISITED  */
+/*  and GOAL fit a maze of the given size. They only ever    */
+/*  grow, so they are reused by every maze the context       */
+/*  generates or solves that is no bigger than the last.     */
+/*************************************************************/
+int growFlags(maze_gen_ctx_t *ctx, int width, int height)
+{
+  size_t flagBytes = ((size_t)width * height + 7) / 8;
+
+  if (flagBytes > ctx->flagBytes)
+  {
+    free(ctx->visitedBits);
+    free(ctx->goalBits);
+    ctx->visitedBits = (uint8*)malloc(flagBytes);
+    ctx->goalBits = (uint8*)malloc(flagBytes);
+    ctx->flagBytes = ctx->visitedBits && ctx->goalBits ? flagBytes : 0;
+    if (!ctx->flagBytes) return FALSE;
+  }
+
+  return TRUE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to clear,                             */
+/*  must have a maze that fits its bitsets.                  */
+/*No return.                                                 */
+/*This function clears VISITED and GOAL from every cell of   */
+/*  the context's maze, which only takes two bits per cell   */
+/*  and never touches the maze.                              */
+/*************************************************************/
+void clearFlags(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+  size_t flagBytes = ((size_t)maze->width * maze->height + 7) / 8;
 
-static maze_t *maze = NULL;
+  memset(ctx->visitedBits, 0, flagBytes);
+  memset(ctx->goalBits, 0, flagBytes);
+  ctx->flagWidth = maze->width;
+}
+
+/*************************************************************/
+/*maze_t *maze:                                              */
+/*  in/out,                                                  */
+/*  maze to clear,                                           */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function zeroes every cell and then fills the border  */
+/*  around the maze with BORDER_CELL. The border is never    */
+/*  zero, so the generator treats it like cells that have    */
+/*  already been carved and never steps onto it.             */
+/*************************************************************/
+void clearCells(maze_t *maze)
+{
+  int x, y;
+  uint8 border = BORDER_CELL(maze);
+
+  memset(maze->cells - MAZE_ROW_ALIGN - maze->stride, 0,
+    (size_t)maze->stride * (maze->height + 2));
+
+  for (x = -1; x <= maze->width; x++)
+  {
+    MAZE_SET(maze, x, -1, border);
+    MAZE_SET(maze, x, maze->height, border);
+  }
+  for (y = 0; y < maze->height; y++)
+  {
+    MAZE_SET(maze, -1, y, border);
+    MAZE_SET(maze, maze->width, y, border);
+  }
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to set up,                            */
+/*  must have a maze.                                        */
+/*No return.                                                 */
+/*This function fills in ctx->probe for the maze's stride.   */
+/*  For each direction of travel it holds the offsets of the */
+/*  cell ahead, the two cells beside and the two cells       */
+/*  diagonally ahead.                                        */
+/*************************************************************/
+void setupProbes(maze_gen_ctx_t *ctx)
+{
+  int i, ahead, side;
+  int stride = ctx->maze->stride;
+
+  for (i = 0; i < NUM_DIRECTIONS; i++)
+  {
+    ahead = DIRECTION_DX[i] + DIRECTION_DY[i] * stride;
+    side = DIRECTION_DY[i] + DIRECTION_DX[i] * stride;
+    ctx->probe[i][0] = ahead;
+    ctx->probe[i][1] = side;
+    ctx->probe[i][2] = -side;
+    ctx->probe[i][3] = ahead + side;
+    ctx->probe[i][4] = ahead - side;
+  }
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to draw from,                         */
+/*  must have been seeded by seedRandom.                     */
+/*Returns a random 32 bit number.                            */
+/*This is the PCG32 (XSH RR) generator: a 64 bit LCG step    */
+/*  followed by an xorshift and a random rotate of the old   */
+/*  state. It is a handful of instructions, needs no locks   */
+/*  and every context carries its own copy.                  */
+/*************************************************************/
+unsigned int ctxRand(maze_gen_ctx_t *ctx)
+{
+  unsigned long long old = ctx->randState;
+  unsigned int xorShifted, rot;
+
+  ctx->randState = old * PCG_MULTIPLIER + ctx->randInc;
+  xorShifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+  rot = (unsigned int)(old >> 59);
+
+  return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to draw from,                         */
+/*  must have been seeded by seedRandom.                     */
+/*unsigned int range:                                        */
+/*  in,                                                      */
+/*  number of possible results,                              */
+/*  must be greater than 0.                                  */
+/*Returns a random number between 0 and range - 1.           */
+/*Scales the 32 bit result by range with a multiply and a    */
+/*  shift instead of a division.                             */
+/*************************************************************/
+unsigned int ctxRandRange(maze_gen_ctx_t *ctx, unsigned int range)
+{
+  return (unsigned int)(((unsigned long long)ctxRand(ctx) * range) >> 32);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to seed,                              */
+/*  must not be NULL.                                        */
+/*unsigned int seed:                                         */
+/*  in,                                                      */
+/*  seed for the random stream,                              */
+/*  can be any value.                                        */
+/*No return.                                                 */
+/*This function restarts the context's random stream. Every  */
+/*  number drawn while generating a maze comes from this     */
+/*  stream, so the seed alone decides the maze's shape.      */
+/*************************************************************/
+void seedRandom(maze_gen_ctx_t *ctx, unsigned int seed)
+{
+  ctx->randState = 0;
+  ctx->randInc = PCG_STREAM;
+  ctxRand(ctx);
+  ctx->randState += seed;
+  ctxRand(ctx);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context that needs a seed,                    */
+/*  must not be NULL.                                        */
+/*Returns the seed to build the next maze from.              */
+/*Uses the seed set by mazeCtxSeed if there is one.          */
+/*  Otherwise the seed is drawn from the context's stream,   */
+/*  which is started from the clock and a process wide       */
+/*  counter the first time it is needed.                     */
+/*************************************************************/
+unsigned int nextMazeSeed(maze_gen_ctx_t *ctx)
+{
+  static volatile int numContexts = 0;
+
+  if (ctx->bSeeded)
+  {
+    ctx->bSeeded = FALSE;
+    return ctx->nextSeed;
+  }
+  if (!ctx->randInc)
+  {
+    seedRandom(ctx, (unsigned int)time(NULL) ^
+      (unsigned int)th_AtomicIncrement(&numContexts) * 0x9E3779B9U);
+  }
+
+  return ctxRand(ctx);
+}
 
 /*************************************************************/
 /*int width:                                                 */
@@ -119,8 +708,8 @@ static maze_t *maze = NULL;
 int checkForNonsense(int width, int height, int wayX, int wayY, int wayLen,
   double wayDirPer, double straightProb, int printSteps)
 {
-  if (width < 3 || width > 1000) return TRUE;
-  else if (height < 3 || height > 1000) return TRUE;
+  if (width < 3 || width > MAZE_MAX_SIZE) return TRUE;
+  else if (height < 3 || height > MAZE_MAX_SIZE) return TRUE;
   else if (wayX < 1 || wayX > width) return TRUE;
   else if (wayY < 1 || wayY > height) return TRUE;
   else if (wayLen < 0 || wayLen > MIN(width, height) / 2) return TRUE;
@@ -132,62 +721,64 @@ int checkForNonsense(int width, int height, int wayX, int wayY, int wayLen,
 }
 
 /*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
 /*int width:                                                 */
 /*  in,                                                      */
 /*  width of the maze,                                       */
-/*  must be between 3 and 1000.                              */
+/*  must be between 3 and MAZE_MAX_SIZE.                     */
 /*int height:                                                */
 /*  in,                                                      */
 /*  height of the maze,                                      */
-/*  must be between 3 and 1000.                              */
-/*No return.                                                 */
+/*  must be between 3 and MAZE_MAX_SIZE.                     */
+/*Returns the new maze, or NULL if it could not be allocated.*/
 /*This function allocates any dynamic memory the maze will   */
 /*  need.                                                    */
 /*Calls mazeFree() to make sure no leftover data is there to */
-/*  prevent memory leaks. Then allocates the pointers that   */
-/*  will point to each column of the 2D maze array. After    */
-/*  this it loops through width number of times, allocating  */
-/*  each column dynamically.                                 */
+/*  prevent memory leaks. Then makes a single aligned        */
+/*  allocation holding the maze_t followed by its cells,     */
+/*  stored row by row with each row padded out to stride     */
+/*  bytes, and clears the cells and their border.            */
+/*If the context is in packed mode a row holds two cells per */
+/*  byte. Either way the side bitsets for VISITED and GOAL   */
+/*  are grown to fit. Nothing is set aside for the BMP       */
+/*  image, which mazePrint only needs while writing it.      */
 /*************************************************************/
-maze_t *allocateMazeData(int width, int height)
+maze_t *allocateMazeData_Ctx(maze_gen_ctx_t *ctx, int width, int height)
 {
-  printf("w = %d, h = %d\n", width, height);
-  mazeFree();
-  int i, rowPadding;
+  if (!ctx->bQuiet) printf("w = %d, h = %d\n", width, height);
+  mazeFree_Ctx(ctx);
+  int stride;
+  maze_t *maze;
 
-  maze = (maze_t*)malloc(sizeof(maze_t));
-  maze->data = (uint8**)malloc(sizeof(uint8*)*width);
-  for (i = 0; i < width; i++)
-  {
-    maze->data[i] = (uint8*)malloc(sizeof(uint8)*height);
-    memset(maze->data[i], 0, height);
-  }
+  // room for the border in front of the row and one cell after it
+  stride = MAZE_ROW_ALIGN + (ctx->bPacked ? (width + 1) / 2 : width) + 1;
+  stride = (stride + MAZE_ROW_ALIGN - 1) / MAZE_ROW_ALIGN * MAZE_ROW_ALIGN;
+
+  if (!growFlags(ctx, width, height)) return NULL;
+
+  maze = (maze_t*)alignedAlloc(MAZE_BLOCK_SIZE(stride, height));
+  if (!maze) return NULL;
+  memset(maze, 0, MAZE_HEADER_SIZE);
+  maze->cells = (uint8*)maze + MAZE_CELLS_OFFSET(stride);
+  maze->stride = stride;
+  maze->bPacked = ctx->bPacked;
   maze->width = width;
   maze->height = height;
-
-#ifdef MAZEIII
-  mazeImg = malloc(sizeof(bmp_image_t));
-  mazeImg->pixelWidth = 8;
-  mazeImg->pixelHeight = 8;
-  mazeImg->rowSize = mazeImg->pixelWidth * 3;
-  rowPadding = (4 - (mazeImg->rowSize % 4)) % 4;
-  //mazeImg->rowSize += rowPadding;
-  mazeImg->pixelDataSize = mazeImg->rowSize*mazeImg->pixelHeight*width*height;
-  mazeImg->imgFileSize = BMP_HEADER + mazeImg->pixelDataSize;
-
-  mazeImg->image = malloc(sizeof(uint8) * mazeImg->pixelDataSize);
-  memset(&mazeImg->image[0], 0xFF, sizeof(unsigned char) *
-    mazeImg->pixelDataSize);
-
-  printf("mazeImg->pixelWidth = %d\n", mazeImg->pixelWidth);
-  printf("mazeImg->pixelHeight = %d\n", mazeImg->pixelHeight);
-  printf("mazeImg->pixelDataSize = %d\n", mazeImg->pixelDataSize);
-#endif
+  ctx->maze = maze;
+  clearCells(maze);
+  clearFlags(ctx);
 
   return maze;
 }
 
 /*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
 /*short x:                                                   */
 /*  in,                                                      */
 /*  x position in the maze,                                  */
@@ -202,8 +793,10 @@ maze_t *allocateMazeData(int width, int height)
 /*Uses simple if/else if statements to check for             */
 /*  valid inputs.                                            */
 /*************************************************************/
-int checkBounds(short x, short y)
+int checkBounds_Ctx(maze_gen_ctx_t *ctx, short x, short y)
 {
+  maze_t *maze = ctx->maze;
+
   if (x > maze->width - 1) return FALSE;
   else if (x < 0) return FALSE;
   else if (y > maze->height - 1) return FALSE;
@@ -213,6 +806,10 @@ int checkBounds(short x, short y)
 }
 
 /*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
 /*short x:                                                   */
 /*  in,                                                      */
 /*  x position in the maze,                                  */
@@ -229,156 +826,261 @@ int checkBounds(short x, short y)
 /*Uses simple if/else if statements to check if either is on */
 /*  an edge. The return value is designed to map to          */
 /*  DIRECTION_LIST, so if it is on an edge using             */
-/*  maze->data[x][y] |= DIRECTION_LIST[return_value] is not  */
-/*  only valid but the intended use of this function (mostly */
-/*  allows for the exit to be punched out when an edge is    */
-/*  found).                                                  */
+/*  MAZE_CELL(maze, x, y) |= DIRECTION_LIST[return_value] is */
+/*  not only valid but the intended use of this function     */
+/*  (mostly allows for the exit to be punched out when an    */
+/*  edge is found).                                          */
 /*************************************************************/
-int checkForEdge(short x, short y)
+int checkForEdge(maze_gen_ctx_t *ctx, short x, short y)
 {
-  if (x == 0 || x == mWidth) return x ? 1 : 3;
-  else if (y == 0 || y == mHeight) return y ? 2 : 0;
+  if (x == 0 || x == ctx->mWidth) return x ? 1 : 3;
+  else if (y == 0 || y == ctx->mHeight) return y ? 2 : 0;
   return INVALID;
 }
 
 /*************************************************************/
-/*short x:                                                   */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in,                                                      */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*int x:                                                     */
 /*  in,                                                      */
 /*  x position in the maze,                                  */
-/*  can be any value - should be a valid x-input.            */
-/*short y:                                                   */
+/*  must not be out of bounds of the maze.                   */
+/*int y:                                                     */
 /*  in,                                                      */
 /*  y position in the maze,                                  */
-/*  can be any value - should be a valid y-input.            */
-/*Returns TRUE if none of the 5 forward directions contain   */
-/*  an active cell and they are not on an edge.              */
-/*This function takes x/y inputs for the maze                */
-/*  and sees if the forward 5 directions from the cell are   */
-/*  already occupied.                                        */
-/*Relies heavily the VISITED flag to have been set on the    */
-/*  **previous** cell. This means that if you are coming from*/
-/*  position (1, 1) and you are checking if (1, 2) has no    */
-/*  adjacent cells already active, first call the markCell   */
-/*  function on position (1, 1) and then call this function  */
-/*  for position (1, 2).                                     */
+/*  must not be out of bounds of the maze.                   */
+/*Returns the index of x/y in ctx->edgeBranches, or INVALID  */
+/*  if it is not on an edge.                                 */
+/*The top row comes first, then the bottom row, then the     */
+/*  left and right columns. The corners belong to their      */
+/*  rows, so the first and last slot of each column is never */
+/*  used.                                                    */
+/*************************************************************/
+int edgeSlot(maze_gen_ctx_t *ctx, int x, int y)
+{
+  int width = ctx->mWidth + 1;
+
+  if (y == 0) return x;
+  else if (y == ctx->mHeight) return width + x;
+  else if (x == 0) return 2 * width + y;
+  else if (x == ctx->mWidth) return 2 * width + ctx->mHeight + 1 + y;
+  return INVALID;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have a maze.                                        */
+/*Returns TRUE if ctx->edgeBranches is ready, FALSE if there */
+/*  was not enough memory for it.                            */
+/*This function makes room for every edge cell of the maze   */
+/*  and marks them all BRANCH_NONE. The line arrays share    */
+/*  the block, one entry for each row and column.            */
 /*************************************************************/
-int checkAdjacent(short x, short y)
+int resetEdgeBranches(maze_gen_ctx_t *ctx)
 {
-  char cx, cy;
+  int slots = 2 * (ctx->mWidth + ctx->mHeight + 2);
 
-  for (cy = -1; cy < 2; cy++)
+  if (slots > ctx->edgeSlots)
   {
-    for (cx = -1; cx < 2; cx++)
-    {
-      if (x + cx == x && y + cy == y) continue;
-      else if (!checkBounds(x + cx, y + cy)) return FALSE;
-      else if (maze->data[x + cx][y + cy] & VISITED) continue;
-      else if (maze->data[x + cx][y + cy]) return FALSE;
-    }
+    free(ctx->edgeBranches);
+    ctx->edgeBranches = (uint8*)malloc(slots * 2);
+    ctx->edgeSlots = ctx->edgeBranches ? slots : 0;
+    if (!ctx->edgeBranches) return FALSE;
+    ctx->lineParents = (char*)ctx->edgeBranches + slots;
+    ctx->lineReach = ctx->lineParents + slots / 2;
   }
+  memset(ctx->edgeBranches, BRANCH_NONE, slots);
 
   return TRUE;
 }
 
 /*************************************************************/
-/*short x:                                                   */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in,                                                      */
+/*  generation context to work with,                         */
+/*  must have a maze.                                        */
+/*int x:                                                     */
 /*  in,                                                      */
 /*  x position in the maze,                                  */
-/*  can be any value - should be a valid x-input.            */
-/*short y:                                                   */
+/*  must be the waypoint or in line with it.                 */
+/*int y:                                                     */
 /*  in,                                                      */
 /*  y position in the maze,                                  */
-/*  can be any value - should be a valid y-input.            */
-/*No return.                                                 */
-/*This function takes an x/y position and creates a + sign   */
-/*  outward from (and including) the x/y position in the     */
-/*  way of marking each cell in the + with the VISITED flag. */
-/*This function is built to work alongside the checkAdjacent */
-/*  function. When this is called on an x, y position, it    */
-/*  exclusive-ORs each cell going outward from the x, y      */
-/*  position in the shape of a + (where the distance from the*/
-/*  x, y position is always +1 or -1) with the VISITED flag. */
-/*  This means that calling it twice will first mark the     */
-/*  cells and then unmark them. So, to use this, first call  */
-/*  this function on the x, y position, then call            */
-/*  the checkAdjacent function, and then call this again     */
-/*  on the same x, y position.                               */
-/*************************************************************/
-void markCell(short x, short y)
+/*  must be the waypoint or in line with it.                 */
+/*Returns BRANCH_WAY for the waypoint, otherwise the index   */
+/*  into DIRECTION_LIST of the direction x/y lies in from    */
+/*  it. This is the branch of a cell next to the waypoint or */
+/*  on one of its alleys.                                    */
+/*************************************************************/
+char wayBranch(maze_gen_ctx_t *ctx, int x, int y)
 {
-  int i;
-  short cx, cy;
-  maze->data[x][y] ^= VISITED; // mark current cell first
+  maze_t *maze = ctx->maze;
 
-  for (i = 0; i < NUM_DIRECTIONS; i++)
-  {
-    cx = x + DIRECTION_DX[i];
-    cy = y + DIRECTION_DY[i];
-    if (!checkBounds(cx, cy)) continue;
-    maze->data[cx][cy] ^= VISITED;
-  }
+  if (x == maze->wayX && y == maze->wayY) return BRANCH_WAY;
+  else if (x == maze->wayX) return y < maze->wayY ? 0 : 2;
+  return x > maze->wayX ? 1 : 3;
 }
 
 /*************************************************************/
-/*short x:                                                   */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in,                                                      */
+/*  generation context to work with,                         */
+/*  must have a maze.                                        */
+/*int x:                                                     */
 /*  in,                                                      */
 /*  x position in the maze,                                  */
-/*  can be any value - should be a valid x-input.            */
-/*short y:                                                   */
+/*  must not be out of bounds of the maze.                   */
+/*int y:                                                     */
 /*  in,                                                      */
 /*  y position in the maze,                                  */
-/*  can be any value - should be a valid y-input.            */
-/*char direction:                                            */
-/*  in,                                                      */
-/*  index of the direction to move,                          */
-/*  should either directly map to DIRECTION_DX/DY or         */
-/*  directly map to randomSets.                              */
-/*Returns TRUE if going straight was fully successful,       */
-/*  FALSE otherwise.                                         */
-/*This function uses the GOSTRAIGHT macro along with         */
-/*  the straight probability to help determine if continuing */
-/*  in the same direction as the cell before is valid.       */
-/*This function first uses GOSTRAIGHT to determine if it     */
-/*  should attempt to continue going straight rather than    */
-/*  choosing a new direction. If so, it then sets up currX   */
-/*  and currY using the direction input. Next it checks the  */
-/*  bounds of the next desired cell as well as whether or    */
-/*  not it is occupied. Finally it marks the current cell,   */
-/*  calls checkAdjacent for currX and currY, and if that     */
-/*  succeeds it will carve a path straight into the new cell */
-/*  and return TRUE to let you know it succeeded. Otherwise, */
-/*  FALSE is returned to let you know it failed.             */
+/*  must not be out of bounds of the maze.                   */
+/*Returns the index of x/y in ctx->lineParents and           */
+/*  ctx->lineReach, or INVALID if it is not in the           */
+/*  waypoint's row or column. The column comes first.        */
 /*************************************************************/
-int checkForStraight(short x, short y, char direction)
+int lineIndex(maze_gen_ctx_t *ctx, int x, int y)
 {
-  if (GOSTRAIGHT(maze->straightProb))
-  {
-    currX = x;
-    currY = y;
-    if (direction < 4)
-    {
-      currX += DIRECTION_DX[direction];
-      currY += DIRECTION_DY[direction];
-    }
-    else
-    {
-      currX += DIRECTION_DX[randomSets[direction]];
-      currY += DIRECTION_DY[randomSets[direction]];
-    }
-    if (checkBounds(currX, currY) && !maze->data[currX][currY])
+  maze_t *maze = ctx->maze;
+
+  if (x == maze->wayX) return y;
+  else if (y == maze->wayY) return ctx->mHeight + 1 + x;
+  return INVALID;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have had resetEdgeBranches called.                  */
+/*int x:                                                     */
+/*  in,                                                      */
+/*  x position of a cell that was just carved,               */
+/*  must not be out of bounds of the maze.                   */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  y position of a cell that was just carved,               */
+/*  must not be out of bounds of the maze.                   */
+/*char branch:                                               */
+/*  in,                                                      */
+/*  BRANCH_* of the cell.                                    */
+/*No return.                                                 */
+/*This function remembers the branch of x/y if it is on an   */
+/*  edge, which is all placeExit needs to know about it.     */
+/*************************************************************/
+void noteBranch(maze_gen_ctx_t *ctx, int x, int y, char branch)
+{
+  int slot = edgeSlot(ctx, x, y);
+
+  if (slot != INVALID) ctx->edgeBranches[slot] = (uint8)branch;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*short x:                                                   */
+/*  in,                                                      */
+/*  x position in the maze,                                  */
+/*  can be any value - should be a valid x-input.            */
+/*short y:                                                   */
+/*  in,                                                      */
+/*  y position in the maze,                                  */
+/*  can be any value - should be a valid y-input.            */
+/*char direction:                                            */
+/*  in,                                                      */
+/*  index into DIRECTION_LIST of the step that reached x/y,  */
+/*  must be between 0 and 3.                                 */
+/*Returns TRUE if none of the 5 forward directions contain   */
+/*  an active cell and they are not on an edge.              */
+/*This function takes x/y inputs for the maze                */
+/*  and sees if the forward 5 directions from the cell are   */
+/*  already occupied.                                        */
+/*The cells behind x/y belong to the cell being carved from, */
+/*  so only the 5 cells ahead and to the sides are looked at.*/
+/*  The border around the maze is filled with non zero       */
+/*  sentinels, which makes "off the maze" and "occupied" the */
+/*  same test: the 5 cells are ORed together and checked     */
+/*  once, with no bounds checks. For unpacked mazes the      */
+/*  cells are read through the offsets in ctx->probe.        */
+/*************************************************************/
+int checkAdjacent(maze_gen_ctx_t *ctx, short x, short y, char direction)
+{
+  maze_t *maze = ctx->maze;
+  const uint8 *cell;
+  const int *probe;
+  short dx, dy, px, py;
+
+  if (!maze->bPacked)
+  {
+    cell = &MAZE_CELL(maze, x, y);
+    probe = ctx->probe[direction];
+    return !(cell[probe[0]] | cell[probe[1]] | cell[probe[2]] |
+      cell[probe[3]] | cell[probe[4]]);
+  }
+
+  dx = DIRECTION_DX[direction];
+  dy = DIRECTION_DY[direction];
+  px = dy; // perpendicular to the direction of travel
+  py = dx;
+  return !(MAZE_GET(maze, x + dx, y + dy) |
+    MAZE_GET(maze, x + px, y + py) | MAZE_GET(maze, x - px, y - py) |
+    MAZE_GET(maze, x + dx + px, y + dy + py) |
+    MAZE_GET(maze, x + dx - px, y + dy - py));
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*short x:                                                   */
+/*  in,                                                      */
+/*  x position in the maze,                                  */
+/*  can be any value - should be a valid x-input.            */
+/*short y:                                                   */
+/*  in,                                                      */
+/*  y position in the maze,                                  */
+/*  can be any value - should be a valid y-input.            */
+/*char direction:                                            */
+/*  in,                                                      */
+/*  index of the direction to move,                          */
+/*  should either directly map to DIRECTION_DX/DY or         */
+/*  directly map to randomSets.                              */
+/*Returns TRUE if going straight was fully successful,       */
+/*  FALSE otherwise.                                         */
+/*This function uses the GOSTRAIGHT macro along with         */
+/*  the straight probability to help determine if continuing */
+/*  in the same direction as the cell before is valid.       */
+/*This function first uses GOSTRAIGHT to determine if it     */
+/*  should attempt to continue going straight rather than    */
+/*  choosing a new direction. If so, it then sets up currX   */
+/*  and currY using the direction input. Next it checks      */
+/*  whether the next desired cell is occupied (the border    */
+/*  counts as occupied). Finally it calls checkAdjacent for  */
+/*  currX and currY, and if that succeeds it will carve a    */
+/*  path straight into the new cell and return TRUE to let   */
+/*  you know it succeeded. Otherwise, FALSE is returned to   */
+/*  let you know it failed.                                  */
+/*************************************************************/
+int checkForStraight(maze_gen_ctx_t *ctx, short x, short y, char direction)
+{
+  if (GOSTRAIGHT(ctx))
+  {
+    if (direction >= 4) direction = ctx->randomSets[direction];
+    ctx->currX = x + DIRECTION_DX[direction];
+    ctx->currY = y + DIRECTION_DY[direction];
+
+    if (!MAZE_GET(ctx->maze, ctx->currX, ctx->currY) &&
+      checkAdjacent(ctx, ctx->currX, ctx->currY, direction))
     {
-      markCell(x, y);
-      if (checkAdjacent(currX, currY))
-      {
-        markCell(x, y);
-        maze->data[x][y] |= direction < 4 ? DIRECTION_LIST[direction] :
-          DIRECTION_LIST[randomSets[direction]];
-        maze->data[currX][currY] |= direction < 4 ? DIRECTION_MAP[direction] :
-          DIRECTION_MAP[randomSets[direction]];
+      carveWall(ctx, x, y, direction);
 
-        return TRUE;
-      }
-      else markCell(x, y);
+      return TRUE;
     }
   }
 
@@ -386,73 +1088,268 @@ int checkForStraight(short x, short y, char direction)
 }
 
 /*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*char type:                                                 */
+/*  in,                                                      */
+/*  kind of frame to push (one of the FRAME_* values).       */
 /*short x:                                                   */
 /*  in,                                                      */
-/*  current x-value within the maze,                         */
+/*  x position in the maze,                                  */
 /*  must not be out of bounds of the maze.                   */
 /*short y:                                                   */
 /*  in,                                                      */
-/*  current y-value within the maze,                         */
+/*  y position in the maze,                                  */
 /*  must not be out of bounds of the maze.                   */
 /*char direction:                                            */
 /*  in,                                                      */
-/*  index of the direction to move,                          */
+/*  index of the direction the frame arrived from,           */
 /*  should either directly map to DIRECTION_DX/DY or         */
 /*  directly map to randomSets.                              */
-/*No return.                                                 */
-/*This function calls itself recursively to create the maze. */
-/*After checking to see it hasn't hit the recursive depth    */
-/*  cap, it selects a random index that corresponds to       */
-/*  the randomSets array - this determines which element     */
-/*  of DX and DY is called, thus randomizing the direction.  */
-/*  Inside the loop, it checks each direction that it can    */
-/*  potentially move and, if it determines it is valid,      */
-/*  calls itself with the new x and y coordinates.           */
+/*Returns TRUE if the frame was pushed, FALSE if the stack   */
+/*  could not be grown, in which case bStackFailed is set so */
+/*  the loop running the stack can give up.                  */
+/*This function pushes a new frame onto the explicit         */
+/*  generation stack.                                        */
+/*The stack lives on the heap and doubles in size whenever   */
+/*  it runs out of room, so the depth of the carve is only   */
+/*  limited by available memory. Pointers into the stack are */
+/*  invalidated by this call.                                */
+/*Apart from the solver's, every frame is pushed by the one  */
+/*  its cell was carved (or walked) from, so the new frame   */
+/*  takes that frame's branch. A frame pushed from the       */
+/*  waypoint or from the alley loop starts a branch of its   */
+/*  own instead. Either way the branch is noted, so by the   */
+/*  time the carve is done every edge cell has one.          */
 /*************************************************************/
-void createMaze_Recursive(short x, short y, char direction)
+int pushFrame(maze_gen_ctx_t *ctx, char type, short x, short y, char direction)
 {
-  if (recursionLevel > MAX_STACK) return;
+  genFrame_t *frame, *below;
 
-  char i, k;
-  char cAdjacent = 1;
-  char index = rand() % MAX_RAND_SETS / NUM_DIRECTIONS * NUM_DIRECTIONS;
+  if (ctx->frameTop == ctx->frameCapacity)
+  {
+    int capacity = ctx->frameCapacity ? ctx->frameCapacity * 2 : MIN_FRAMES;
+    genFrame_t *temp = (genFrame_t*)realloc(ctx->frameStack,
+      sizeof(genFrame_t) * capacity);
+    if (!temp)
+    {
+      ctx->bStackFailed = 1;
+      return FALSE;
+    }
+    ctx->frameStack = temp;
+    ctx->frameCapacity = capacity;
+  }
 
-  recursionLevel++;
+  frame = &ctx->frameStack[ctx->frameTop++];
+  frame->x = x;
+  frame->y = y;
+  frame->direction = direction;
+  frame->index = 0;
+  frame->pass = 0;
+  frame->k = 0;
+  frame->type = type;
+  frame->stage = STAGE_ENTER;
+  if (type == FRAME_SOLVE) return TRUE;
 
-  if (checkForStraight(x, y, direction))
+  below = ctx->frameTop > 1 ? frame - 1 : NULL;
+  if (!below || below->type == FRAME_ALLEYS || below->branch == BRANCH_WAY)
   {
-    createMaze_Recursive(currX, currY, direction);
+    frame->branch = wayBranch(ctx, x, y);
   }
+  else frame->branch = below->branch;
+  noteBranch(ctx, x, y, frame->branch);
+
+  return TRUE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*genFrame_t *frame:                                         */
+/*  in/out,                                                  */
+/*  frame to continue searching from,                        */
+/*  must have had its index chosen already.                  */
+/*Returns the randomSets index of the direction that was     */
+/*  carved, or INVALID if the frame has no moves left.       */
+/*This function is the body of the direction loop shared by  */
+/*  every carving frame.                                     */
+/*It walks the randomized directions for the frame twice.    */
+/*  During the first pass a neighbor is only carved into if  */
+/*  none of its forward cells are active (see checkAdjacent);*/
+/*  during the second pass that check is turned off to       */
+/*  ensure that all parts of the maze are filled. The loop   */
+/*  counters are stored in the frame so that the search can  */
+/*  resume where it left off once the new cell (left in      */
+/*  currX and currY) has been fully explored.                */
+/*************************************************************/
+char nextCarveDirection(maze_gen_ctx_t *ctx, genFrame_t *frame)
+{
+  maze_t *maze = ctx->maze;
+  short x = frame->x;
+  short y = frame->y;
+  char setIndex;
 
-  for (i = 0; i < 2; i++)
+  for (; frame->pass < 2; frame->pass++, frame->k = 0)
   {
-    for (k = 0; k < NUM_DIRECTIONS; k++)
+    for (; frame->k < NUM_DIRECTIONS; frame->k++)
     {
-      currX = x + DIRECTION_DX[randomSets[index + k]];
-      currY = y + DIRECTION_DY[randomSets[index + k]];
+      setIndex = frame->index + frame->k;
+      ctx->currX = x + DIRECTION_DX[ctx->randomSets[setIndex]];
+      ctx->currY = y + DIRECTION_DY[ctx->randomSets[setIndex]];
+
+      // the border is never empty, so this also keeps us in bounds.
+      // No flags are set while carving, so the walls are enough.
+      if (MAZE_GET(maze, ctx->currX, ctx->currY)) continue;
+
+      if (!frame->pass && !checkAdjacent(ctx, ctx->currX, ctx->currY,
+        ctx->randomSets[setIndex])) continue;
+
+      carveWall(ctx, x, y, ctx->randomSets[setIndex]);
+      frame->k++; // resume with the next direction
+      return setIndex;
+    }
+  }
+
+  return INVALID;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*Returns TRUE once the stack is empty, FALSE if it could    */
+/*  not be grown, which leaves the maze half carved.         */
+/*This function runs the generation stack until it is empty, */
+/*  carving the maze from the frames that were pushed on it. */
+/*Each frame is a small state machine standing in for one    */
+/*  call of the old recursive carvers:                       */
+/*  FRAME_FILL carves depth first until every reachable cell */
+/*    is filled.                                             */
+/*  FRAME_CARVE does the same from an alley entry point but  */
+/*    only for cellsLeft cells. Once that runs out the       */
+/*    remaining alleys are carved, and then every frame of   */
+/*    the exhausted alley fills the maze from its cell,      */
+/*    deepest first.                                         */
+/*  FRAME_ALLEYS loops over the alleys starting at           */
+/*    alleyIndex, giving each one a fresh cell budget.       */
+/*  The child's result is passed back through frameReturn.   */
+/*  Nothing here recurses, so the size of the maze is no     */
+/*  longer bounded by the C stack.                           */
+/*************************************************************/
+int carveMaze_Iterative(maze_gen_ctx_t *ctx)
+{
+  genFrame_t *frame;
+  char frameReturn = FALSE;
+  char setIndex;
+
+  ctx->bStackFailed = 0;
+  while (ctx->frameTop > 0 && !ctx->bStackFailed)
+  {
+    frame = &ctx->frameStack[ctx->frameTop - 1];
 
-      if (currX < 0 || currX > mWidth || currY < 0 || currY > mHeight ||
-        maze->data[currX][currY]) continue;
+    switch (frame->type)
+    {
+    case FRAME_FILL:
+      if (frame->stage == STAGE_ENTER)
+      {
+        frame->index = RANDOM_SET_INDEX(ctx);
+        frame->stage = STAGE_LOOP;
+        if (checkForStraight(ctx, frame->x, frame->y, frame->direction))
+        {
+          pushFrame(ctx, FRAME_FILL, ctx->currX, ctx->currY, frame->direction);
+        }
+      }
+      else if ((setIndex = nextCarveDirection(ctx, frame)) != INVALID)
+      {
+        pushFrame(ctx, FRAME_FILL, ctx->currX, ctx->currY, setIndex);
+      }
+      else ctx->frameTop--;
+      break;
 
-      if (cAdjacent)
+    case FRAME_CARVE:
+      switch (frame->stage)
       {
-        markCell(x, y);
-        if (!checkAdjacent(currX, currY))
+      case STAGE_ENTER:
+        if (ctx->cellsLeft < 1)
+        {
+          ctx->alleyIndex++;
+          if (ctx->trace) traceEvent(ctx, 0, 0, MAZE_EVENT_MARK, 0);
+          frame->stage = STAGE_EXHAUSTED;
+          pushFrame(ctx, FRAME_ALLEYS, frame->x, frame->y, frame->direction);
+          break;
+        }
+
+        frame->index = RANDOM_SET_INDEX(ctx);
+        frame->stage = STAGE_LOOP;
+        // the result of going straight is deliberately ignored
+        if (checkForStraight(ctx, frame->x, frame->y, frame->direction))
+        {
+          --ctx->cellsLeft;
+          pushFrame(ctx, FRAME_CARVE, ctx->currX, ctx->currY, frame->direction);
+        }
+        break;
+      case STAGE_LOOP:
+        if ((setIndex = nextCarveDirection(ctx, frame)) != INVALID)
+        {
+          --ctx->cellsLeft;
+          frame->stage = STAGE_RESULT;
+          pushFrame(ctx, FRAME_CARVE, ctx->currX, ctx->currY, setIndex);
+        }
+        else
+        {
+          frameReturn = FALSE;
+          ctx->frameTop--;
+        }
+        break;
+      case STAGE_RESULT:
+        if (frameReturn)
         {
-          markCell(x, y); // will unmark
-          continue;
+          frame->stage = STAGE_RETURN;
+          pushFrame(ctx, FRAME_FILL, frame->x, frame->y, frame->direction);
         }
-        markCell(x, y); // will unmark
+        else frame->stage = STAGE_LOOP;
+        break;
+      case STAGE_EXHAUSTED:
+        if (ctx->trace) traceEvent(ctx, 0, 0, MAZE_EVENT_MARK, 0);
+        frame->stage = STAGE_RETURN;
+        pushFrame(ctx, FRAME_FILL, frame->x, frame->y, frame->direction);
+        break;
+      case STAGE_RETURN:
+        frameReturn = TRUE;
+        ctx->frameTop--;
+        break;
+      }
+      break;
+
+    case FRAME_ALLEYS:
+      if (frame->stage == STAGE_RESULT)
+      {
+        if (ctx->trace) traceEvent(ctx, 0, 0, MAZE_EVENT_MARK, 0);
+        ctx->alleyIndex++;
       }
 
-      maze->data[x][y] |= DIRECTION_LIST[randomSets[index + k]];
-      maze->data[currX][currY] |= DIRECTION_MAP[randomSets[index + k]];
-      createMaze_Recursive(currX, currY, index + k);
+      if (ctx->alleyIndex < NUM_DIRECTIONS)
+      {
+        ctx->cellsLeft = ctx->numCells;
+        if (ctx->trace) traceEvent(ctx, 0, 0, MAZE_EVENT_MARK, 0);
+        frame->stage = STAGE_RESULT;
+        setIndex = ctx->rand_alleys[ctx->alleyIndex];
+        pushFrame(ctx, FRAME_CARVE, ctx->alleymap_X[setIndex],
+          ctx->alleymap_Y[setIndex], setIndex);
+      }
+      else ctx->frameTop--;
+      break;
     }
-    cAdjacent = 0;
   }
 
-  recursionLevel--;
+  if (!ctx->bStackFailed) return TRUE;
+  ctx->frameTop = 0;
+  return FALSE;
 }
 
 /*************************************************************/
@@ -482,29 +1379,10 @@ int containsNum(char *arr, int indices, char num)
 }
 
 /*************************************************************/
-/*No inputs.                                                 */
-/*No return.                                                 */
-/*The purpose of this function is to limit *all* cells in    */
-/*  the maze to 0x0F, eliminating all other bits.            */
-/*This function loops through the entire maze and ANDs each  */
-/*  cell with BITSLICE_0x0F.                                 */
-/*************************************************************/
-void sliceBits_0x0F()
-{
-  if (maze)
-  {
-    int x, y;
-    for (y = 0; y < mHeight + 1; y++)
-    {
-      for (x = 0; x < mWidth + 1; x++)
-      {
-        maze->data[x][y] &= BITSLICE_0x0F;
-      }
-    }
-  }
-}
-
-/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to draw random numbers from,          */
+/*  must not be NULL.                                        */
 /*uint8 *arr:                                                */
 /*  in,                                                      */
 /*  array to place the random values,                        */
@@ -522,15 +1400,15 @@ void sliceBits_0x0F()
 /*  the current index of the array is given the random value */
 /*  and i is incremented.                                    */
 /*************************************************************/
-void randomizeArray(uint8 *arr, int indices, int limit)
+void randomizeArray(maze_gen_ctx_t *ctx, uint8 *arr, int indices, int limit)
 {
   char i = 0;
   char index;
-  arr[0] = rand() % limit;
+  arr[0] = ctxRandRange(ctx, limit);
 
   while (i < indices)
   {
-    index = rand() % limit;
+    index = ctxRandRange(ctx, limit);
     if (!containsNum(arr, indices, index))
     {
       arr[i] = index;
@@ -540,7 +1418,10 @@ void randomizeArray(uint8 *arr, int indices, int limit)
 }
 
 /*************************************************************/
-/*No inputs.                                                 */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
 /*No return.                                                 */
 /*This function initializes the arrays that are necessary    */
 /*  to work with the alleys for Maze II.                     */
@@ -556,241 +1437,872 @@ void randomizeArray(uint8 *arr, int indices, int limit)
 /*  randomizeArray is called so that the alley access points */
 /*  are randomized.                                          */
 /*************************************************************/
-void initArrays()
+void initArrays(maze_gen_ctx_t *ctx)
 {
+  maze_t *maze = ctx->maze;
   int i;
 
   for (i = 0; i < 4; i++)
   {
-    alleymap_X[i] = maze->wayX + (maze->alleyLen * DIRECTION_DX[i]);
-    alleymap_Y[i] = maze->wayY + (maze->alleyLen * DIRECTION_DY[i]);
+    ctx->alleymap_X[i] = maze->wayX + (maze->alleyLen * DIRECTION_DX[i]);
+    ctx->alleymap_Y[i] = maze->wayY + (maze->alleyLen * DIRECTION_DY[i]);
 
-    if (alleymap_X[i] < 0) alleymap_X[i] = 0;
-    else if (alleymap_X[i] > mWidth + 1) alleymap_X[i] = mWidth;
-    if (alleymap_Y[i] < 0) alleymap_Y[i] = 0;
-    else if (alleymap_Y[i] > mHeight + 1) alleymap_Y[i] = mHeight;
+    // the alleys are carved from these cells without any bounds checks
+    if (ctx->alleymap_X[i] < 0) ctx->alleymap_X[i] = 0;
+    else if (ctx->alleymap_X[i] > ctx->mWidth)
+      ctx->alleymap_X[i] = ctx->mWidth;
+    if (ctx->alleymap_Y[i] < 0) ctx->alleymap_Y[i] = 0;
+    else if (ctx->alleymap_Y[i] > ctx->mHeight)
+      ctx->alleymap_Y[i] = ctx->mHeight;
   }
 
-  memset(&rand_alleys[0], -1, 4);
-  randomizeArray(&rand_alleys[0], 4, 4);
+  memset(&ctx->rand_alleys[0], -1, 4);
+  randomizeArray(ctx, &ctx->rand_alleys[0], 4, 4);
 }
 
 /*************************************************************/
-/*short x:                                                   */
-/*  in,                                                      */
-/*  current x-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*short y:                                                   */
-/*  in,                                                      */
-/*  current y-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*char direction:                                            */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*char index:                                                */
 /*  in,                                                      */
-/*  index of the direction to move,                          */
-/*  should either directly map to DIRECTION_DX/DY or         */
-/*  directly map to randomSets.                              */
-/*Returns TRUE if it has hit the end of the run (when        */
-/*  cellsLeft is less than 1). This lets the caller know     */
-/*  that it is time to stop and call createMaze_Recursive    */
-/*  (after all alleys are finished). FALSE is returned       */
-/*  otherwise.                                               */
-/*This function calls itself recursively to create the maze  */
-/*  from the alley entry points.                             */
-/*After checking to see it hasn't hit the recursive depth    */
-/*  cap and that it still has cells left and that it should  */
-/*  not continue going straight, it selects a random index   */
-/*  that corresponds to the randomSets array - this          */
-/*  determines which element of DX and DY is called, thus    */
-/*  randomizing the direction. Inside the loop, it checks    */
-/*  each direction that it can potentially move and, if it   */
-/*  determines it is valid, (i.e. there are no active cells  */
-/*  adjacent to it), calls itself with the new x and y       */
-/*  coordinates. During the second loop through, the         */
-/*  check to see if there are no active adjacent cells       */
-/*  is turned off to ensure that all parts of the maze are   */
-/*  filled.                                                  */
-/*************************************************************/
-int carveAlleys_Recursive(short x, short y, char direction)
-{
-  static int cellsLeft = 0;
-  if (recursionLevel > MAX_STACK) return FALSE;
-  if (cellsLeft < 1)
-  {
-    alleyIndex++;
-    if (maze->printSteps) mazePrint();
-    for (alleyIndex; alleyIndex < NUM_DIRECTIONS; alleyIndex++)
-    {
-      cellsLeft = numCells;
-      if (maze->printSteps) mazePrint();
-      carveAlleys_Recursive(alleymap_X[rand_alleys[alleyIndex]],
-        alleymap_Y[rand_alleys[alleyIndex]],
-        rand_alleys[alleyIndex]);
-      if (maze->printSteps) mazePrint();
-    }
-    if (maze->printSteps) mazePrint();
+/*  index of the alley to carve,                             */
+/*  should directly map to alleymap_X/Y.                     */
+/*No return.                                                 */
+/*This function carves one of the maze alleys.               */
+/*It walks from the waypoint towards the alleymap_X/Y limits */
+/*  for its index by using DIRECTION_DX/DY, stopping once it */
+/*  gets there or would leave the maze. It loops rather than */
+/*  recursing, so a long alley takes no C stack.             */
+/*************************************************************/
+void setupAlleys(maze_gen_ctx_t *ctx, char index)
+{
+  maze_t *maze = ctx->maze;
+  short x = maze->wayX;
+  short y = maze->wayY;
+
+  while (x != ctx->alleymap_X[index] || y != ctx->alleymap_Y[index])
+  {
+    ctx->currX = x + DIRECTION_DX[index];
+    ctx->currY = y + DIRECTION_DY[index];
 
-    createMaze_Recursive(x, y, direction);
+    if (!checkBounds_Ctx(ctx, ctx->currX, ctx->currY)) return;
 
-    return TRUE;
+    carveWall(ctx, x, y, index);
+    noteBranch(ctx, ctx->currX, ctx->currY, index);
+    x = ctx->currX;
+    y = ctx->currY;
   }
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have its alleys set up.                             */
+/*Returns TRUE once the maze is carved, FALSE if the         */
+/*  generation stack ran out of memory.                      */
+/*This function is the Joel's Algorithm engine: it carves    */
+/*  out from each alley in turn with carveMaze_Iterative.    */
+/*************************************************************/
+int carveJoel(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
 
-  char i, k;
-  char index = rand() % MAX_RAND_SETS / NUM_DIRECTIONS * NUM_DIRECTIONS;
-  char cAdjacent = 1;
+  if (!pushFrame(ctx, FRAME_ALLEYS, maze->wayX, maze->wayY, INVALID))
+  {
+    return FALSE;
+  }
+  return carveMaze_Iterative(ctx);
+}
 
-  recursionLevel++;
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have a fully carved maze.                           */
+/*Returns TRUE once every cell has been walked, FALSE if the */
+/*  generation stack ran out of memory.                      */
+/*Joel's Algorithm carves out from the waypoint, so it knows */
+/*  the branch of each cell as it goes. The other engines    */
+/*  join cells in no particular order and call this instead: */
+/*  it walks the finished tree depth first from the waypoint */
+/*  (never stepping back the way it came, so no flags are    */
+/*  needed) and lets pushFrame note the branches.            */
+/*On the way back up it also records, for the cells in line  */
+/*  with the waypoint, the step that reached them and        */
+/*  whether their subtree reaches the edge (see              */
+/*  splitBranches).                                          */
+/*************************************************************/
+int walkBranches_Iterative(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+  genFrame_t *frame;
+  char k;
+  int i;
 
-  if (checkForStraight(x, y, direction))
+  if (!pushFrame(ctx, FRAME_WALK, maze->wayX, maze->wayY, INVALID))
   {
-    --cellsLeft;
-    carveAlleys_Recursive(currX, currY, direction);
+    return FALSE;
   }
 
-  for (i = 0; i < 2; i++)
+  while (ctx->frameTop > 0)
   {
-    for (k = 0; k < NUM_DIRECTIONS; k++)
+    frame = &ctx->frameStack[ctx->frameTop - 1];
+    if (frame->stage == STAGE_ENTER)
     {
-      currX = x + DIRECTION_DX[randomSets[index + k]];
-      currY = y + DIRECTION_DY[randomSets[index + k]];
+      frame->reach = checkForEdge(ctx, frame->x, frame->y) != INVALID;
+      frame->stage = STAGE_LOOP;
+    }
 
-      if (!checkBounds(currX, currY) || maze->data[currX][currY]) continue;
+    for (k = frame->k; k < NUM_DIRECTIONS; k++)
+    {
+      if (!(MAZE_GET(maze, frame->x, frame->y) & DIRECTION_LIST[k])) continue;
+      if (frame->direction == INVALID ||
+        DIRECTION_LIST[k] != DIRECTION_MAP[(int)frame->direction]) break;
+    }
 
-      if (cAdjacent)
+    if (k < NUM_DIRECTIONS)
+    {
+      frame->k = k + 1;
+      if (!pushFrame(ctx, FRAME_WALK, frame->x + DIRECTION_DX[k],
+        frame->y + DIRECTION_DY[k], k))
       {
-        markCell(x, y);
-        if (!checkAdjacent(currX, currY))
-        {
-          markCell(x, y); // will unmark
-          continue;
-        }
-        markCell(x, y); // will unmark
+        ctx->frameTop = 0;
+        return FALSE;
       }
-      maze->data[x][y] |= DIRECTION_LIST[randomSets[index + k]];
-      maze->data[currX][currY] |= DIRECTION_MAP[randomSets[index + k]];
-      --cellsLeft;
-      if (carveAlleys_Recursive(currX, currY, index + k))
+    }
+    else
+    {
+      if (ctx->frameTop > 1) frame[-1].reach |= frame->reach;
+      if ((i = lineIndex(ctx, frame->x, frame->y)) != INVALID)
       {
-        createMaze_Recursive(x, y, direction);
-        recursionLevel--;
-        return TRUE;
+        ctx->lineParents[i] = frame->direction;
+        ctx->lineReach[i] = frame->reach;
       }
+      ctx->frameTop--;
     }
-
-    cAdjacent = 0; // set this to off for the next round
   }
 
-  recursionLevel--;
-  return FALSE;
+  return TRUE;
 }
 
 /*************************************************************/
-/*short x:                                                   */
-/*  in,                                                      */
-/*  current x-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*short y:                                                   */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have just been walked by walkBranches_Iterative.    */
+/*int direction:                                             */
 /*  in,                                                      */
-/*  current y-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*char index:                                                */
+/*  index into DIRECTION_LIST to head in from the waypoint,  */
+/*  must not start off the maze.                             */
+/*char bToEdge:                                              */
 /*  in,                                                      */
-/*  index of the direction to move,                          */
-/*  should directly map to alleymap_X/Y.                     */
+/*  TRUE to run all the way to the edge, FALSE to stop at    */
+/*  the first cell whose subtree reaches it.                 */
 /*No return.                                                 */
-/*This function calls itself recursively to create the maze  */
-/*  alleys.                                                  */
-/*Checks to see if the current x/y position is equal to      */
-/*  the current alleymap_X/Y limits (and calls the next alley*/
-/*  if so). Otherwise, it continues moving towards the       */
-/*  alleymap_X/Y limits for its current index by using       */
-/*  DIRECTION_DX/DY.                                         */
+/*This function straightens the tree out from the waypoint:  */
+/*  each cell along the line is cut from the cell it hung    */
+/*  from and joined to the one before it instead, taking its */
+/*  subtree along. Nothing on the line so far is below the   */
+/*  cell being moved, so the maze stays a perfect tree. The  */
+/*  cells passed over end up on the side of the waypoint     */
+/*  the line leaves from.                                    */
 /*************************************************************/
-void setupAlleys_Recursive(short x, short y, char index)
+void forceLine(maze_gen_ctx_t *ctx, int direction, char bToEdge)
 {
-  if (index > 3) return;
-  else if (x == alleymap_X[index] && y == alleymap_Y[index])
+  maze_t *maze = ctx->maze;
+  int x = maze->wayX, y = maze->wayY, i;
+  char k;
+
+  do
   {
-    setupAlleys_Recursive(maze->wayX, maze->wayY, index + 1);
-    return;
-  }
+    x += DIRECTION_DX[direction];
+    y += DIRECTION_DY[direction];
+    i = lineIndex(ctx, x, y);
+    if (getCell(ctx, x, y) & DIRECTION_MAP[direction]) continue;
 
-  currX = x + DIRECTION_DX[index];
-  currY = y + DIRECTION_DY[index];
+    k = ctx->lineParents[i];
+    xorCell(ctx, x, y, DIRECTION_MAP[(int)k]);
+    xorCell(ctx, x - DIRECTION_DX[(int)k], y - DIRECTION_DY[(int)k],
+      DIRECTION_LIST[(int)k]);
+    if (ctx->trace)
+    {
+      traceEvent(ctx, x - DIRECTION_DX[(int)k], y - DIRECTION_DY[(int)k],
+        MAZE_EVENT_CLOSE, k);
+    }
+    carveWall(ctx, x - DIRECTION_DX[direction], y - DIRECTION_DY[direction],
+      direction);
+  } while ((bToEdge || !ctx->lineReach[i]) &&
+    checkForEdge(ctx, x, y) == INVALID);
+}
 
-  if (!checkBounds(currX, currY)) return;
+/*************************************************************/
+/*int *parent:                                               */
+/*  in/out,                                                  */
+/*  union-find parents of the sets in a streamed row,        */
+/*  must not be NULL.                                        */
+/*int set:                                                   */
+/*  in,                                                      */
+/*  set to look up,                                          */
+/*  must be less than the width of the row.                  */
+/*Returns the set that set has been merged into.             */
+/*Halves the path on the way up so later lookups are short.  */
+/*************************************************************/
+int findSet(int *parent, int set)
+{
+  while (parent[set] != set)
+  {
+    parent[set] = parent[parent[set]];
+    set = parent[set];
+  }
 
-  maze->data[x][y] |= DIRECTION_LIST[index];
-  maze->data[currX][currY] |= DIRECTION_MAP[index];
-  setupAlleys_Recursive(currX, currY, index);
+  return set;
 }
 
 /*************************************************************/
-/*int width:                                                 */
-/*  in,                                                      */
-/*  width of the maze,                                       */
-/*  must be between 3 and 1000.                              */
-/*int height:                                                */
-/*  in,                                                      */
-/*  height of the maze,                                      */
-/*  must be between 3 and 1000.                              */
-/*int wayPointX:                                             */
-/*  in,                                                      */
-/*  x-location to start carving for the maze,                */
-/*  must be from 1 to the width of the maze.                 */
-/*int wayPointY:                                             */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have a maze.                                        */
+/*size_t numCells:                                           */
 /*  in,                                                      */
-/*  x-location to start carving for the maze,                */
-/*  must be from 1 to the height of the maze.                */
-/*The other inputs are not used for this lab!                */
-/*No FALSE if all went well - TRUE if not.                   */
-/*This function is what generates the maze itself.           */
-/*Calls checkForNonsense to make sure the inputs aren't      */
-/*  invalid. If they aren't, it checks to see if the         */
-/*  width and height are identical to the last maze,         */
-/*  and if so it will zero out the old array and reuse it.   */
-/*  Otherwise, allocateMazeData is called. After this,       */
-/*  all variables in the maze pointer are set and            */
-/*  carveAlleys_Recursive is called. At the end it will      */
-/*  begin calling mazeSolve in order to determine if the     */
-/*  created maze is actually valid. If not, the current maze */
-/*  is dumped and restarted to try and create a valid maze.  */
+/*  number of cells the sets and edges must cover,           */
+/*  can be any value.                                        */
+/*Returns TRUE if the context's Kruskal arrays are big       */
+/*  enough, FALSE if there was not enough memory for them.   */
+/*The arrays only ever grow, so regenerating a maze of the   */
+/*  same size does not allocate.                             */
 /*************************************************************/
-maze_t *mazeGenerate(int width, int height, // [3, 1000],  [3, 1000]
-  int wayPointX, int wayPointY,       // [1, width],   [1, height]
-  int wayPointAlleyLength,            // [0,  min(width, height)/2 ]
-  double wayPointDirectionPercent,    // [0.0,  1.0]
-  double straightProbability,         // [0.0,  1.0]
-  int printAlgorithmSteps)            // [TRUE | FALSE]
+int reserveSets(maze_gen_ctx_t *ctx, size_t numCells)
 {
-  if (checkForNonsense(width, height, wayPointX, wayPointY,
-    wayPointAlleyLength, wayPointDirectionPercent,
-    straightProbability, printAlgorithmSteps))
+  if (numCells > ctx->setCells)
   {
-    printf("Error - invalid parameters to mazeGenerate.\n");
-    return NULL;
+    free(ctx->sets);
+    free(ctx->edges);
+    ctx->sets = (int*)malloc(sizeof(int) * numCells);
+    ctx->edges = (unsigned int*)malloc(sizeof(unsigned int) * 2 * numCells);
+    ctx->setCells = ctx->sets && ctx->edges ? numCells : 0;
+    if (!ctx->setCells) return FALSE;
   }
-  int i;
 
-  // Can we just reuse the old maze's data (just zero it out)?
-  if (maze && maze->width == width && maze->height == height)
+  return TRUE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have its alleys set up.                             */
+/*int left, int top:                                         */
+/*  in,                                                      */
+/*  top left cell of the region to carve,                    */
+/*  must be in bounds.                                       */
+/*int width, int height:                                     */
+/*  in,                                                      */
+/*  size of the region in cells,                             */
+/*  must fit inside the maze.                                */
+/*Returns TRUE once the region is carved, FALSE if there was */
+/*  not enough memory for the sets and edges.                */
+/*This function is the Kruskal engine. Every cell starts in  */
+/*  a set of its own, apart from the alleys which are        */
+/*  already carved and start joined. The east and south edge */
+/*  of every cell go into one flat array which is shuffled   */
+/*  as it is walked (Fisher-Yates, one swap per edge), and   */
+/*  an edge is carved whenever it joins two different sets.  */
+/*  The walk stops as soon as everything is one set, so the  */
+/*  result is a perfect maze after at most one pass over the */
+/*  edges, with no recursion and no dead ends to back out    */
+/*  of. straightProbability and wayPointDirectionPercent do  */
+/*  not apply.                                               */
+/*Only cells inside the region are read or written, so       */
+/*  regions that do not share a byte can be carved at the    */
+/*  same time from separate contexts.                        */
+/*************************************************************/
+int kruskalRegion(maze_gen_ctx_t *ctx, int left, int top,
+  int width, int height)
+{
+  size_t numCells = (size_t)width * height;
+  size_t numEdges = 0, numSets = numCells, i, j;
+  unsigned int edge;
+  int x, y, a, b, cell, direction;
+  uint8 walls;
+
+  if (!reserveSets(ctx, numCells)) return FALSE;
+
+  for (i = 0; i < numCells; i++)
   {
-    for (i = 0; i < maze->width; i++)
-    {
-      memset(maze->data[i], 0, height);
-    }
+    ctx->sets[i] = (int)i;
   }
-  else
+
+  // edge cell * 2 is the cell's east wall, cell * 2 + 1 its south wall
+  for (y = 0, cell = 0; y < height; y++)
   {
-    allocateMazeData(width, height);
-    memset(randomSets, -1, MAX_RAND_SETS);
-    for (i = 0; i < MAX_RAND_SETS / NUM_DIRECTIONS; i++)
+    for (x = 0; x < width; x++, cell++)
     {
-      randomizeArray(&randomSets[i * NUM_DIRECTIONS], NUM_DIRECTIONS,
-        NUM_DIRECTIONS);
-    }
+      walls = MAZE_GET(ctx->maze, left + x, top + y);
+      if (x < width - 1)
+      {
+        if (walls & EAST)
+        {
+          ctx->sets[findSet(ctx->sets, cell)] = findSet(ctx->sets, cell + 1);
+          numSets--;
+        }
+        else ctx->edges[numEdges++] = (unsigned int)cell * 2;
+      }
+      if (y < height - 1)
+      {
+        if (walls & SOUTH)
+        {
+          ctx->sets[findSet(ctx->sets, cell)] =
+            findSet(ctx->sets, cell + width);
+          numSets--;
+        }
+        else ctx->edges[numEdges++] = (unsigned int)cell * 2 + 1;
+      }
+    }
+  }
+
+  for (i = 0; i < numEdges && numSets > 1; i++)
+  {
+    j = i + ctxRandRange(ctx, (unsigned int)(numEdges - i));
+    edge = ctx->edges[j];
+    ctx->edges[j] = ctx->edges[i];
+
+    cell = (int)(edge >> 1);
+    direction = edge & 1 ? 2 : 1; // index of SOUTH or EAST
+    a = findSet(ctx->sets, cell);
+    b = findSet(ctx->sets, cell + (edge & 1 ? width : 1));
+    if (a == b) continue;
+
+    ctx->sets[a] = b;
+    numSets--;
+    carveWall(ctx, left + cell % width, top + cell / width, direction);
+  }
+
+  return TRUE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have its alleys set up.                             */
+/*Returns TRUE once the maze is carved, FALSE if there was   */
+/*  not enough memory for the sets and edges.                */
+/*This function runs kruskalRegion over the whole maze and   */
+/*  then walks it for placeExit.                             */
+/*************************************************************/
+int carveKruskal(maze_gen_ctx_t *ctx)
+{
+  return kruskalRegion(ctx, 0, 0, ctx->maze->width, ctx->maze->height) &&
+    walkBranches_Iterative(ctx);
+}
+
+/*************************************************************/
+/*th_func_t func:                                            */
+/*  in,                                                      */
+/*  function every thread runs,                              */
+/*  must not be NULL.                                        */
+/*void *arg:                                                 */
+/*  in/out,                                                  */
+/*  handed to func on every thread.                          */
+/*int numThreads:                                            */
+/*  in,                                                      */
+/*  number of threads to run func on,                        */
+/*  1 or less runs it on the calling thread only.            */
+/*No return.                                                 */
+/*This function starts numThreads - 1 extra threads, runs    */
+/*  func on the calling thread as well and waits for all of  */
+/*  them. Workers are expected to claim their work from a    */
+/*  shared counter, so if a thread cannot be created the     */
+/*  others pick up its share.                                */
+/*************************************************************/
+void runWorkers(th_func_t func, void *arg, int numThreads)
+{
+  thread_t **threads;
+  int i;
+
+  threads = numThreads > 1 ?
+    (thread_t**)malloc(sizeof(thread_t*) * (numThreads - 1)) : NULL;
+
+  for (i = 0; threads && i < numThreads - 1; i++)
+  {
+    threads[i] = th_Create(func, arg);
+  }
+  func(arg);
+  for (i = 0; threads && i < numThreads - 1; i++)
+  {
+    th_Join(threads[i]);
+  }
+  free(threads);
+}
+
+/*************************************************************/
+/*void *arg:                                                 */
+/*  in/out,                                                  */
+/*  the mazeTiles_t being worked on,                         */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function is run by every thread of a carveTiled call, */
+/*  including the one that called it. Each worker borrows    */
+/*  the shared maze in a context of its own and carves the   */
+/*  tiles it claims with kruskalRegion, reseeding for each   */
+/*  tile so the result does not depend on which thread got   */
+/*  it.                                                      */
+/*************************************************************/
+void tileWorker(void *arg)
+{
+  mazeTiles_t *tiles = (mazeTiles_t*)arg;
+  maze_gen_ctx_t *ctx = mazeCtxCreate();
+  int i, left, top;
+
+  if (!ctx) return;
+  ctx->maze = tiles->maze;
+  ctx->trace = tiles->trace;
+
+  while ((i = th_AtomicIncrement(&tiles->next) - 1) <
+    tiles->tilesX * tiles->tilesY)
+  {
+    left = i % tiles->tilesX * MAZE_TILE_SIZE;
+    top = i / tiles->tilesX * MAZE_TILE_SIZE;
+    seedRandom(ctx, tiles->seed ^ (unsigned int)i * TILE_SEED_STEP);
+    if (kruskalRegion(ctx, left, top,
+      MIN(MAZE_TILE_SIZE, tiles->maze->width - left),
+      MIN(MAZE_TILE_SIZE, tiles->maze->height - top)))
+    {
+      th_AtomicIncrement(&tiles->done);
+    }
+  }
+
+  // the maze belongs to the caller's context
+  ctx->maze = NULL;
+  mazeCtxDestroy(ctx);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have every tile carved.                             */
+/*int tilesX, int tilesY:                                    */
+/*  in,                                                      */
+/*  number of tiles across and down,                         */
+/*  must match the maze.                                     */
+/*Returns TRUE once the tiles are joined, FALSE if there was */
+/*  not enough memory for the sets and edges.                */
+/*Every tile is a perfect maze of its own, so joining them   */
+/*  is Kruskal again with one set per tile: each boundary    */
+/*  between two tiles is an edge, and carving an edge opens  */
+/*  a single random passage along it. Boundaries an alley    */
+/*  already crosses start joined, the same way alley cells   */
+/*  do in kruskalRegion.                                     */
+/*************************************************************/
+int stitchTiles(maze_gen_ctx_t *ctx, int tilesX, int tilesY)
+{
+  maze_t *maze = ctx->maze;
+  size_t numTiles = (size_t)tilesX * tilesY;
+  size_t numEdges = 0, numSets = numTiles, i, j;
+  unsigned int edge;
+  int x, y, a, b, tile, left, top, direction;
+
+  if (!reserveSets(ctx, numTiles)) return FALSE;
+
+  for (i = 0; i < numTiles; i++)
+  {
+    ctx->sets[i] = (int)i;
+  }
+
+  // edge tile * 2 is the boundary with the tile to the east, tile * 2 + 1
+  // the one with the tile to the south
+  for (tile = 0; tile < (int)numTiles; tile++)
+  {
+    left = tile % tilesX * MAZE_TILE_SIZE;
+    top = tile / tilesX * MAZE_TILE_SIZE;
+    if (tile % tilesX < tilesX - 1)
+    {
+      x = left + MAZE_TILE_SIZE - 1;
+      for (y = top; y < MIN(top + MAZE_TILE_SIZE, maze->height) &&
+        !(MAZE_GET(maze, x, y) & EAST); y++);
+      if (y < MIN(top + MAZE_TILE_SIZE, maze->height))
+      {
+        ctx->sets[findSet(ctx->sets, tile)] = findSet(ctx->sets, tile + 1);
+        numSets--;
+      }
+      else ctx->edges[numEdges++] = (unsigned int)tile * 2;
+    }
+    if (tile / tilesX < tilesY - 1)
+    {
+      y = top + MAZE_TILE_SIZE - 1;
+      for (x = left; x < MIN(left + MAZE_TILE_SIZE, maze->width) &&
+        !(MAZE_GET(maze, x, y) & SOUTH); x++);
+      if (x < MIN(left + MAZE_TILE_SIZE, maze->width))
+      {
+        ctx->sets[findSet(ctx->sets, tile)] =
+          findSet(ctx->sets, tile + tilesX);
+        numSets--;
+      }
+      else ctx->edges[numEdges++] = (unsigned int)tile * 2 + 1;
+    }
+  }
+
+  for (i = 0; i < numEdges && numSets > 1; i++)
+  {
+    j = i + ctxRandRange(ctx, (unsigned int)(numEdges - i));
+    edge = ctx->edges[j];
+    ctx->edges[j] = ctx->edges[i];
+
+    tile = (int)(edge >> 1);
+    a = findSet(ctx->sets, tile);
+    b = findSet(ctx->sets, tile + (edge & 1 ? tilesX : 1));
+    if (a == b) continue;
+
+    ctx->sets[a] = b;
+    numSets--;
+    left = tile % tilesX * MAZE_TILE_SIZE;
+    top = tile / tilesX * MAZE_TILE_SIZE;
+    if (edge & 1)
+    {
+      direction = 2; // index of SOUTH
+      x = left + ctxRandRange(ctx, MIN(MAZE_TILE_SIZE, maze->width - left));
+      y = top + MAZE_TILE_SIZE - 1;
+    }
+    else
+    {
+      direction = 1; // index of EAST
+      x = left + MAZE_TILE_SIZE - 1;
+      y = top + ctxRandRange(ctx, MIN(MAZE_TILE_SIZE, maze->height - top));
+    }
+    carveWall(ctx, x, y, direction);
+  }
+
+  return TRUE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have its alleys set up.                             */
+/*Returns TRUE once the maze is carved, FALSE if there was   */
+/*  not enough memory for a tile or the stitching.           */
+/*This function is the tiled engine, for mazes big enough    */
+/*  to want every core. The maze is cut into square tiles of */
+/*  MAZE_TILE_SIZE cells, which the threads carve with       */
+/*  kruskalRegion at the same time (see mazeCtxSetThreads),  */
+/*  and stitchTiles then joins them into one perfect maze.   */
+/*  Each tile's seed comes from the maze's seed and the      */
+/*  tile's index, so the maze is the same for any number of  */
+/*  threads.                                                 */
+/*************************************************************/
+int carveTiled(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+  mazeTiles_t tiles;
+  int numTiles, numThreads = ctx->numThreads;
+
+  tiles.maze = maze;
+  tiles.tilesX = (maze->width + MAZE_TILE_SIZE - 1) / MAZE_TILE_SIZE;
+  tiles.tilesY = (maze->height + MAZE_TILE_SIZE - 1) / MAZE_TILE_SIZE;
+  tiles.seed = ctxRand(ctx);
+  tiles.next = 0;
+  tiles.done = 0;
+  numTiles = tiles.tilesX * tiles.tilesY;
+
+  if (numThreads <= 0) numThreads = th_NumCores();
+  if (numThreads > numTiles) numThreads = numTiles;
+  // one trace can only be written from one thread, and the tiles come
+  // out the same on any number of them
+  if (ctx->trace) numThreads = 1;
+  tiles.trace = ctx->trace;
+  runWorkers(tileWorker, &tiles, numThreads);
+  if (tiles.done < numTiles) return FALSE;
+
+  return stitchTiles(ctx, tiles.tilesX, tiles.tilesY) &&
+    walkBranches_Iterative(ctx);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have every edge cell's branch noted.                */
+/*Returns TRUE once the start and exit are open, FALSE if no */
+/*  exit can be reached through the waypoint.                */
+/*This function picks the start and exit of a carved maze    */
+/*  in one pass over its edge cells, with no solving.        */
+/*The maze is a tree, so the path from the start to the      */
+/*  exit goes through the waypoint exactly when the two      */
+/*  hang off different sides of it (or one of them is the    */
+/*  waypoint). The start stays in the column drawn for it    */
+/*  if any edge cell is on another side; otherwise it moves  */
+/*  along the top row to the nearest cell that has one. The  */
+/*  exit is then drawn from every edge cell that is not on   */
+/*  the start's side.                                        */
+/*************************************************************/
+int placeExit(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+  int width = ctx->mWidth + 1;
+  int slots = 2 * (width + ctx->mHeight + 1);
+  int counts[NUM_BRANCHES] = { 0 };
+  int i, x, y, pick, total = 0, startX = INVALID;
+  uint8 branch = BRANCH_NONE;
+
+  for (i = 0; i < slots; i++)
+  {
+    if (ctx->edgeBranches[i] != BRANCH_NONE)
+    {
+      counts[ctx->edgeBranches[i]]++;
+      total++;
+    }
+  }
+
+  // the drawn column, then the ones next to it on either side
+  for (i = 0; i < 2 * width && startX == INVALID; i++)
+  {
+    x = maze->startX + (i + 1) / 2 * (i & 1 ? -1 : 1);
+    if (x < 0 || x >= width) continue;
+    branch = ctx->edgeBranches[x]; // the top row comes first
+    if (total > counts[branch]) startX = x;
+  }
+  if (startX == INVALID) return FALSE;
+
+  pick = ctxRandRange(ctx, total - counts[branch]);
+  for (i = 0; i < slots; i++)
+  {
+    if (ctx->edgeBranches[i] == BRANCH_NONE) continue;
+    if (ctx->edgeBranches[i] != branch && !pick--) break;
+  }
+
+  // back from edgeSlot's order to a cell
+  if (i < 2 * width)
+  {
+    x = i % width;
+    y = i < width ? 0 : ctx->mHeight;
+  }
+  else
+  {
+    x = i < 2 * width + ctx->mHeight + 1 ? 0 : ctx->mWidth;
+    y = (i - 2 * width) % (ctx->mHeight + 1);
+  }
+
+  maze->startX = startX;
+  maze->endX = x;
+  maze->endY = y;
+  orCell(ctx, maze->startX, maze->startY, NORTH);
+  orCell(ctx, x, y, DIRECTION_LIST[checkForEdge(ctx, x, y)]);
+  if (ctx->trace)
+  {
+    traceEvent(ctx, maze->startX, maze->startY, MAZE_EVENT_OPEN, 0);
+    traceEvent(ctx, x, y, MAZE_EVENT_OPEN, checkForEdge(ctx, x, y));
+  }
+
+  return TRUE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have had placeExit fail on it.                      */
+/*Returns TRUE once the start and exit are open, FALSE if    */
+/*  the generation stack ran out of memory.                  */
+/*placeExit fails when every edge cell hangs off the same    */
+/*  side of the waypoint, which happens whenever one branch  */
+/*  of the carve gets all the way round the maze before the  */
+/*  others reach the edge. Rather than carving again, this   */
+/*  function gives another side an edge cell: out of the     */
+/*  three directions away from that side it picks the one    */
+/*  with the shortest straight line to a cell whose subtree  */
+/*  reaches the edge and forces that line (see forceLine).   */
+/*  If the line happens to take the whole top row with it,   */
+/*  straight lines to the top and bottom rows always work,   */
+/*  as they put an edge cell on two different sides. Either  */
+/*  way it is a couple of walks over the tree, never a       */
+/*  second carve.                                            */
+/*************************************************************/
+int splitBranches(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+  int d, x, y, steps, best = INVALID, bestSteps = INT_MAX;
+  uint8 side = ctx->edgeBranches[maze->startX];
+
+  if (!walkBranches_Iterative(ctx)) return FALSE;
+
+  for (d = 0; d < NUM_DIRECTIONS; d++)
+  {
+    if (d == side) continue;
+    x = maze->wayX;
+    y = maze->wayY;
+    steps = 0;
+    do
+    {
+      x += DIRECTION_DX[d];
+      y += DIRECTION_DY[d];
+      steps++;
+    } while (!ctx->lineReach[lineIndex(ctx, x, y)] &&
+      checkForEdge(ctx, x, y) == INVALID);
+
+    if (steps < bestSteps)
+    {
+      best = d;
+      bestSteps = steps;
+    }
+  }
+
+  forceLine(ctx, best, FALSE);
+  if (!resetEdgeBranches(ctx) || !walkBranches_Iterative(ctx)) return FALSE;
+  if (placeExit(ctx)) return TRUE;
+
+  forceLine(ctx, 0, TRUE);
+  forceLine(ctx, 2, TRUE);
+  if (!resetEdgeBranches(ctx) || !walkBranches_Iterative(ctx)) return FALSE;
+
+  return placeExit(ctx);
+}
+
+// Indexed by MAZE_ALGO_*. Each engine is handed a cleared maze with its
+// alleys carved and has to connect every cell.
+static const mazeAlgorithm_t mazeAlgorithms[MAZE_NUM_ALGOS] =
+{
+  { "joel", carveJoel },
+  { "kruskal", carveKruskal },
+  { "tiled", carveTiled }
+};
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context that is about to carve,               */
+/*  must have a maze, its alleys set up and a trace.         */
+/*No return.                                                 */
+/*This function empties the trace for a new carve and gets   */
+/*  its player ready: a blank maze of the same size, with    */
+/*  the same waypoint and alleys so frames print the way     */
+/*  the generator's own maze would. If the player can not    */
+/*  be allocated the trace is marked as failed.              */
+/*************************************************************/
+void startTrace(maze_gen_ctx_t *ctx)
+{
+  maze_trace_t *trace = ctx->trace;
+  maze_gen_ctx_t *player = trace->player;
+  maze_t *maze = ctx->maze, *frame = player->maze;
+
+  trace->numEvents = 0;
+  trace->position = 0;
+  trace->width = maze->width;
+  trace->height = maze->height;
+  trace->bFailed = FALSE;
+
+  if (frame && frame->width == maze->width && frame->height == maze->height)
+  {
+    clearCells(frame);
+  }
+  else frame = allocateMazeData_Ctx(player, maze->width, maze->height);
+  if (!frame)
+  {
+    trace->bFailed = TRUE;
+    return;
+  }
+
+  frame->wayX = maze->wayX;
+  frame->wayY = maze->wayY;
+  frame->alleyLen = maze->alleyLen;
+  memcpy(player->alleymap_X, ctx->alleymap_X, sizeof(ctx->alleymap_X));
+  memcpy(player->alleymap_Y, ctx->alleymap_Y, sizeof(ctx->alleymap_Y));
+  player->mWidth = ctx->mWidth;
+  player->mHeight = ctx->mHeight;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*int width:                                                 */
+/*  in,                                                      */
+/*  width of the maze,                                       */
+/*  must be between 3 and MAZE_MAX_SIZE.                     */
+/*int height:                                                */
+/*  in,                                                      */
+/*  height of the maze,                                      */
+/*  must be between 3 and MAZE_MAX_SIZE.                     */
+/*int wayPointX:                                             */
+/*  in,                                                      */
+/*  x-location to start carving for the maze,                */
+/*  must be from 1 to the width of the maze.                 */
+/*int wayPointY:                                             */
+/*  in,                                                      */
+/*  x-location to start carving for the maze,                */
+/*  must be from 1 to the height of the maze.                */
+/*The other inputs are not used for this lab!                */
+/*No FALSE if all went well - TRUE if not.                   */
+/*This function is what generates the maze itself.           */
+/*Calls checkForNonsense to make sure the inputs aren't      */
+/*  invalid. If they aren't, it checks to see if the         */
+/*  width and height are identical to the last maze,         */
+/*  and if so it will zero out the old array and reuse it.   */
+/*  Otherwise, allocateMazeData is called. After this,       */
+/*  all variables in the maze pointer are set, the alleys    */
+/*  are laid out and the context's algorithm (see            */
+/*  mazeCtxSetAlgorithm) carves the rest. The carve notes    */
+/*  which side of the waypoint every edge cell hangs off, so */
+/*  placeExit can open a start and an exit whose path goes   */
+/*  through the waypoint straight away. Nothing is solved    */
+/*  and nothing is generated twice.                          */
+/*************************************************************/
+maze_t *mazeGenerate_Ctx(maze_gen_ctx_t *ctx,
+  int width, int height,              // [3, MAZE_MAX_SIZE] each
+  int wayPointX, int wayPointY,       // [1, width],   [1, height]
+  int wayPointAlleyLength,            // [0,  min(width, height)/2 ]
+  double wayPointDirectionPercent,    // [0.0,  1.0]
+  double straightProbability,         // [0.0,  1.0]
+  int printAlgorithmSteps)            // [TRUE | FALSE]
+{
+  if (checkForNonsense(width, height, wayPointX, wayPointY,
+    wayPointAlleyLength, wayPointDirectionPercent,
+    straightProbability, printAlgorithmSteps))
+  {
+    printf("Error - invalid parameters to mazeGenerate.\n");
+    return NULL;
+  }
+  int i;
+  unsigned int seed = nextMazeSeed(ctx);
+  maze_t *maze = ctx->maze;
+  maze_trace_t *trace = ctx->trace;
+
+  seedRandom(ctx, seed);
+
+  // Can we just reuse the old maze's data (just zero it out)?
+  if (maze && maze->width == width && maze->height == height &&
+    maze->bPacked == ctx->bPacked)
+  {
+    clearCells(maze);
+    clearFlags(ctx);
+  }
+  else
+  {
+    maze = allocateMazeData_Ctx(ctx, width, height);
+    if (!maze)
+    {
+      printf("Error - out of memory in mazeGenerate.\n");
+      return NULL;
+    }
   }
+  setupProbes(ctx);
 
-  maze->startX = rand() % width;
+  maze->seed = seed;
+  memset(ctx->randomSets, -1, MAX_RAND_SETS);
+  for (i = 0; i < MAX_RAND_SETS / NUM_DIRECTIONS; i++)
+  {
+    randomizeArray(ctx, &ctx->randomSets[i * NUM_DIRECTIONS],
+      NUM_DIRECTIONS, NUM_DIRECTIONS);
+  }
+
+  // only a preference, placeExit has the final say
+  maze->startX = ctxRandRange(ctx, width);
   maze->startY = 0;
   //maze->endX = rand() % width;
   //maze->endY = height - 1;
@@ -800,376 +2312,1895 @@ maze_t *mazeGenerate(int width, int height, // [3, 1000],  [3, 1000]
   maze->dirPercent = wayPointDirectionPercent;
   maze->straightProb = straightProbability;
   maze->printSteps = printAlgorithmSteps;
+  // straight when a 32 bit draw lands below straightProb * 2^32
+  ctx->straightLimit = (unsigned long long)(straightProbability *
+    4294967296.0);
 
-  mWidth = width - 1;
-  mHeight = height - 1;
+  ctx->mWidth = width - 1;
+  ctx->mHeight = height - 1;
 
-  numCells = width * height * wayPointDirectionPercent;
-  alleyIndex = 0;
+  ctx->numCells = width * height * wayPointDirectionPercent;
+  ctx->alleyIndex = 0;
+  if (!resetEdgeBranches(ctx))
+  {
+    printf("Error - out of memory in mazeGenerate.\n");
+    return NULL;
+  }
 
-  initArrays();
+  initArrays(ctx);
+  // the steps are recorded now and printed once the maze is done
+  if (printAlgorithmSteps && !trace)
+  {
+    if (!ctx->stepTrace) ctx->stepTrace = mazeTraceCreate();
+    ctx->trace = ctx->stepTrace;
+  }
+  if (ctx->trace) startTrace(ctx);
   //createMaze_Recursive(wayPointX - 1, wayPointY - 1);
-  for (i = 0; i < 4; i++) setupAlleys_Recursive(maze->wayX, maze->wayY, i);
-  //setupAlleys_Recursive(maze->wayX, maze->wayY, 0);
-  for (alleyIndex; alleyIndex < NUM_DIRECTIONS; alleyIndex++)
+  for (i = 0; i < 4; i++)
+  {
+    setupAlleys(ctx, i);
+  }
+  if (!mazeAlgorithms[(int)ctx->algorithm].carve(ctx) ||
+    (!placeExit(ctx) && !splitBranches(ctx)))
+  {
+    ctx->trace = trace;
+    printf("Error - out of memory in mazeGenerate.\n");
+    return NULL;
+  }
+  if (printAlgorithmSteps && ctx->trace) mazeTraceReplay(ctx->trace, 0);
+  ctx->trace = trace;
+
+  return maze;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*short x:                                                   */
+/*  in,                                                      */
+/*  x-value to start solving from,                           */
+/*  must not be out of bounds of the maze.                   */
+/*short y:                                                   */
+/*  in,                                                      */
+/*  y-value to start solving from,                           */
+/*  must not be out of bounds of the maze.                   */
+/*Returns TRUE if the end has been found, FALSE if not or if */
+/*  the generation stack could not be grown.                 */
+/*This function solves the maze depth first using the        */
+/*  generation stack in place of recursion.                  */
+/*When a frame is entered it checks to see if the current    */
+/*  cell is the exit (once the waypoint has been passed).    */
+/*  If not it loops through all 4 possible                   */
+/*  directions and sees if there are unvisited cells next to */
+/*  them. If there are it pushes a frame with the new x and  */
+/*  y coordinates. When a child finds the end, each frame    */
+/*  below it marks its cell as part of the GOAL path. This   */
+/*  continues until the whole maze is solved.                */
+/*************************************************************/
+int mazeSolve_Iterative(maze_gen_ctx_t *ctx, short x, short y)
+{
+  maze_t *maze = ctx->maze;
+  genFrame_t *frame;
+  char frameReturn = FALSE;
+  char i;
+
+  if (!pushFrame(ctx, FRAME_SOLVE, x, y, INVALID)) return FALSE;
+
+  ctx->bStackFailed = 0;
+  while (ctx->frameTop > 0 && !ctx->bStackFailed)
   {
-    if (maze->printSteps) mazePrint();
-    carveAlleys_Recursive(alleymap_X[rand_alleys[alleyIndex]],
-      alleymap_Y[rand_alleys[alleyIndex]],
-      rand_alleys[alleyIndex]);
-    if (maze->printSteps) mazePrint();
+    frame = &ctx->frameStack[ctx->frameTop - 1];
+    x = frame->x;
+    y = frame->y;
+
+    switch (frame->stage)
+    {
+    case STAGE_ENTER:
+      orCell(ctx, x, y, VISITED); // set this cell to visited
+
+      if (x == maze->endX && y == maze->endY &&
+        ctx->bFoundWay && !ctx->bFoundExit)
+      {
+        ctx->bFoundExit = 1;
+        orCell(ctx, x, y, GOAL);
+        frameReturn = TRUE;
+        ctx->frameTop--;
+      }
+      else if (x == maze->wayX && y == maze->wayY && !ctx->bFoundWay)
+      {
+        ctx->bFoundWay = 1;
+        orCell(ctx, x, y, GOAL);
+        frame->stage = STAGE_RETURN;
+        pushFrame(ctx, FRAME_SOLVE, maze->wayX, maze->wayY, INVALID);
+      }
+      else frame->stage = STAGE_LOOP;
+      break;
+    case STAGE_LOOP:
+      for (; frame->k < NUM_DIRECTIONS; frame->k++)
+      {
+        i = frame->k;
+        ctx->currX = x + DIRECTION_DX[i];
+        ctx->currY = y + DIRECTION_DY[i];
+
+        if (ctx->currX < 0 || ctx->currX > maze->width - 1) continue;
+        else if (ctx->currY < 0 || ctx->currY > maze->height - 1) continue;
+        else if (getCell(ctx, ctx->currX, ctx->currY) & VISITED) continue;
+        else if (getCell(ctx, x, y) & DIRECTION_LIST[i]) break;
+      }
+
+      if (frame->k < NUM_DIRECTIONS)
+      {
+        frame->k++;
+        frame->stage = STAGE_RESULT;
+        pushFrame(ctx, FRAME_SOLVE, ctx->currX, ctx->currY, i);
+      }
+      else
+      {
+        frameReturn = FALSE;
+        ctx->frameTop--;
+      }
+      break;
+    case STAGE_RESULT:
+      if (frameReturn)
+      {
+        orCell(ctx, x, y, GOAL);
+        ctx->frameTop--;
+      }
+      else frame->stage = STAGE_LOOP;
+      break;
+    case STAGE_RETURN:
+      frameReturn = TRUE;
+      ctx->frameTop--;
+      break;
+    }
+  }
+
+  if (!ctx->bStackFailed) return frameReturn;
+  ctx->frameTop = 0;
+  return FALSE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function is called when the maze needs to be solved.  */
+/*Makes sure there is actually an active maze available. If  */
+/*  there is, it solves it with mazeSolveShared_Ctx, which   */
+/*  marks the path through the waypoint to the exit as GOAL  */
+/*  in the context's bitsets. mazeGenerate has already       */
+/*  placed the exit so that this path exists, so the maze is */
+/*  never regenerated.                                       */
+/*************************************************************/
+void mazeSolve_Ctx(maze_gen_ctx_t *ctx)
+{
+  if (ctx->maze) mazeSolveShared_Ctx(ctx, ctx->maze);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to solve with,                                   */
+/*  must not be NULL.                                        */
+/*const maze_t *maze:                                        */
+/*  in,                                                      */
+/*  maze to solve,                                           */
+/*  must not be NULL.                                        */
+/*Returns TRUE if the path to the exit was found, FALSE if   */
+/*  there is none or the bitsets could not be grown.         */
+/*This function solves a maze without writing to it. All of  */
+/*  the scratch flags go into the context's bitsets, which   */
+/*  are cleared and reused by every solve, so any number of  */
+/*  threads can solve the same maze at once as long as each  */
+/*  one has its own context, with no copy of the maze.       */
+/*The maze can belong to another context or to no context    */
+/*  at all. It is only borrowed while it is solved, and the  */
+/*  path is read back with mazeCtxOnPath. It replaces the    */
+/*  context's own flags, so mazePrint_Ctx shows no path on   */
+/*  the context's maze until it is solved again.             */
+/*************************************************************/
+int mazeSolveShared_Ctx(maze_gen_ctx_t *ctx, const maze_t *maze)
+{
+  maze_t *own = ctx->maze;
+  int bFound;
+
+  if (!growFlags(ctx, maze->width, maze->height)) return FALSE;
+
+  // only read, orCell keeps the solver's flags out of the cells
+  ctx->maze = (maze_t*)maze;
+  clearFlags(ctx);
+  ctx->bFoundWay = 0;
+  ctx->bFoundExit = 0;
+  bFound = mazeSolve_Iterative(ctx, maze->startX, maze->startY);
+  ctx->frameTop = 0;
+  ctx->maze = own;
+
+  return bFound;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in,                                                      */
+/*  context that solved a maze,                              */
+/*  must not be NULL.                                        */
+/*int x, int y:                                              */
+/*  in,                                                      */
+/*  cell of the maze that was solved last,                   */
+/*  must be in bounds.                                       */
+/*Returns TRUE if the cell is on the path the last solve     */
+/*  found, FALSE otherwise.                                  */
+/*************************************************************/
+int mazeCtxOnPath(maze_gen_ctx_t *ctx, int x, int y)
+{
+  size_t index = (size_t)y * ctx->flagWidth + x;
+
+  if (!ctx->flagBytes) return FALSE;
+
+  return (ctx->goalBits[index >> 3] & FLAG_BIT(index)) != 0;
+}
+
+#ifdef MAZEIII
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*int mazeX:                                                 */
+/*  in,                                                      */
+/*  current x-value within the maze,                         */
+/*  must not be out of bounds of the maze.                   */
+/*int mazeY:                                                 */
+/*  in,                                                      */
+/*  current y-value within the maze,                         */
+/*  must not be out of bounds of the maze.                   */
+/*bmp_image_t *strip:                                        */
+/*  in/out,                                                  */
+/*  strip holding row mazeY of the image,                    */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function determines what walls it needs to draw       */
+/*  for the current cell and writes them to an array.        */
+/*Loops through, checking each cell against DIRECTION_LIST[i]*/
+/*  and, if the cell contains that wall, calls the current   */
+/*  function at index i from D_FUNCS (which are mapped       */
+/*  to DIRECTION_LIST). Each function inside of D_FUNCS      */
+/*  corresponds to a specific drawing function capable       */
+/*  of drawing the desired walls. At the end, fixWalls is    */
+/*  called to eliminate extra walls so that a path is        */
+/*  established.                                             */
+/*************************************************************/
+void writePixelBlock(maze_gen_ctx_t *ctx, int mazeX, int mazeY,
+  bmp_image_t *strip)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+  {
+    if (getCell(ctx, mazeX, mazeY) & DIRECTION_LIST[i])
+    {
+      D_FUNCS[i](&strip->image[0], strip->rowSize*(ctx->mWidth + 1),
+        strip->pixelHeight, mazeX * 8, 0);
+    }
+  }
+
+  fixWalls(&strip->image[0], strip->rowSize*(ctx->mWidth + 1),
+    strip->pixelHeight, mazeX * 8, 0);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*int mazeX:                                                 */
+/*  in,                                                      */
+/*  current x-value within the maze,                         */
+/*  must not be out of bounds of the maze.                   */
+/*bmp_image_t *strip:                                        */
+/*  in/out,                                                  */
+/*  strip holding the cell's row of the image,               */
+/*  must not be NULL.                                        */
+/*unsigned char r:                                           */
+/*  in,                                                      */
+/*  red value for the current cell,                          */
+/*  should be [0, 255].                                      */
+/*unsigned char g:                                           */
+/*  in,                                                      */
+/*  green value for the current cell,                        */
+/*  should be [0, 255].                                      */
+/*unsigned char b:                                           */
+/*  in,                                                      */
+/*  blue value for the current cell,                         */
+/*  should be [0, 255].                                      */
+/*No return.                                                 */
+/*This function colors inside the walls of the desired       */
+/*  cell using the desired color.                            */
+/*This uses a makeshift method of coloring where, when       */
+/*  a wall of r/g/b values 0/0/0 is found, bShouldColor is   */
+/*  inverted. When bShouldColor is 1, it colors. Otherwise   */
+/*  it won't color. This produces decent colored cells but   */
+/*  could definitely be better.                              */
+/*************************************************************/
+void setBlockColor(maze_gen_ctx_t *ctx, int mazeX, bmp_image_t *strip,
+  unsigned char r, unsigned char g, unsigned char b)
+{
+  int x, y, k, cx, cy;
+  char bShouldColor = 0;
+  unsigned char rd, gr, bl;
+
+  for (k = 0; k < 2; k++)
+  {
+    for (y = 0; y < 8; y++)
+    {
+      for (x = 0; x < 8; x++)
+      {
+        cx = !k ? x : y;
+        cy = !k ? y : x;
+
+        getRGB(&strip->image[0], cx + (mazeX * 8), cy,
+          strip->rowSize*(ctx->mWidth + 1), strip->pixelHeight,
+          &rd, &gr, &bl);
+        if (!rd && !gr && !bl) // pixel is not just white
+        {
+          bShouldColor = !bShouldColor;
+        }
+        else if (bShouldColor)
+        {
+          setRGB(&strip->image[0], cx + (mazeX * 8), cy,
+            strip->rowSize*(ctx->mWidth + 1), strip->pixelHeight,
+            r, g, b);
+        }
+      }
+    }
+  }
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must have a maze.                                        */
+/*bmp_image_t *strip:                                        */
+/*  out,                                                     */
+/*  strip to set up for the maze,                            */
+/*  must not be NULL.                                        */
+/*Returns the opened maze.bmp with its header written, or    */
+/*  NULL if the maze gets no image.                          */
+/*This function starts writing the image of the maze. Only   */
+/*  one row of cells is held at a time, so the memory it     */
+/*  takes grows with the width of the maze and not its       */
+/*  area. Mazes too big for a BMP and failed allocations     */
+/*  are only printed as text.                                */
+/*************************************************************/
+FILE *startImage(maze_gen_ctx_t *ctx, bmp_image_t *strip)
+{
+  maze_t *maze = ctx->maze;
+  unsigned char bmpHeader[BMP_HEADER];
+  FILE *f;
+
+  if ((double)maze->width * maze->height * BMP_CELL_BYTES >
+    INT_MAX - BMP_HEADER)
+  {
+    return NULL;
+  }
+
+  strip->pixelWidth = 8;
+  strip->pixelHeight = 8;
+  strip->rowSize = strip->pixelWidth * 3;
+  strip->stripSize = BMP_CELL_BYTES * maze->width;
+  strip->pixelDataSize = strip->stripSize * maze->height;
+  strip->imgFileSize = BMP_HEADER + strip->pixelDataSize;
+
+  strip->image = (uint8*)malloc(strip->stripSize);
+  if (!strip->image) return NULL;
+  f = fopen("maze.bmp", "wb");
+  if (!f)
+  {
+    free(strip->image);
+    return NULL;
+  }
+
+  // fill in a copy so that separate contexts can print at once
+  memcpy(bmpHeader, header, BMP_HEADER);
+  copyIntToAddress(strip->imgFileSize, &bmpHeader[2]);
+  copyIntToAddress(strip->pixelWidth*(ctx->mWidth + 1), &bmpHeader[18]);
+  copyIntToAddress(strip->pixelHeight*(ctx->mHeight + 1), &bmpHeader[22]);
+  copyIntToAddress(strip->pixelDataSize, &bmpHeader[34]);
+  fwrite(bmpHeader, 1, sizeof(bmpHeader), f);
+
+  return f;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*bmp_image_t *strip:                                        */
+/*  in/out,                                                  */
+/*  strip holding row y of the image,                        */
+/*  must not be NULL.                                        */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  row of the maze the strip was drawn from,                */
+/*  must not be out of bounds of the maze.                   */
+/*FILE *f:                                                   */
+/*  in/out,                                                  */
+/*  image from startImage,                                   */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function writes a finished strip to its place in the  */
+/*  image and clears it for the next row. BMP rows run from  */
+/*  the bottom up, so the first row of the maze goes last.   */
+/*************************************************************/
+void writeImageRow(maze_gen_ctx_t *ctx, bmp_image_t *strip, int y, FILE *f)
+{
+  long offset = BMP_HEADER + (long)(ctx->mHeight - y) * strip->stripSize;
+
+  fseek(f, offset, SEEK_SET);
+  fwrite(&strip->image[0], 1, strip->stripSize, f);
+  memset(&strip->image[0], 0xFF, strip->stripSize);
+}
+#endif
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*int x:                                                     */
+/*  in,                                                      */
+/*  current x-value within the maze,                         */
+/*  must not be out of bounds of the maze.                   */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  current y-value within the maze,                         */
+/*  must not be out of bounds of the maze.                   */
+/*Returns TRUE if the current cell is part of an alley,      */
+/*  FALSE if not.                                            */
+/*This function checks to see if the current cell is         */
+/*  part of an alley.                                        */
+/*Uses simple if statements to enforce constraints that,     */
+/*  if true, indicate that the current cell is part of an    */
+/*  alley. If none of the constraints result in an entirely  */
+/*  true statement, the current cell is not part of an alley.*/
+/*************************************************************/
+int isAlley(maze_gen_ctx_t *ctx, int x, int y)
+{
+  maze_t *maze = ctx->maze;
+
+  if (x == maze->wayX && y >= ctx->alleymap_Y[0] && y <= ctx->alleymap_Y[2])
+  {
+    return TRUE;
+  }
+  else if (y == maze->wayY && x >= ctx->alleymap_X[3] && x <= ctx->alleymap_X[1])
+  {
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function prints out the current color-coded maze.     */
+/*Makes sure there is actually an active maze available. If  */
+/*  there is, it loops through each cell, printing its data. */
+/*  If it is either the waypointX and Y or if it is          */
+/*  part of the goal, it will color them differently than    */
+/*  the rest of the maze.                                    */
+/*************************************************************/
+void mazePrint_Ctx(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+
+  if (maze)
+  {
+    int i, k;
+
+#ifdef MAZEIII
+    bmp_image_t strip;
+    FILE *f = startImage(ctx, &strip);
+
+    if (f) memset(&strip.image[0], 0xFF, strip.stripSize);
+#endif
+
+    printf("\n\n");
+    printf("========================\n");
+    printf("Maze(%d x %d): (%d, %d)\n", maze->width, maze->height,
+      maze->wayX + 1, maze->wayY + 1);
+    printf("========================\n");
+
+    for (i = 0; i < maze->height; i++)
+    {
+      for (k = 0; k < maze->width; k++)
+      {
+#ifdef MAZEIII
+        if (f) writePixelBlock(ctx, k, i, &strip);
+#endif
+        if (getCell(ctx, k, i) & GOAL)
+        {
+          textcolor(32);
+#ifdef MAZEIII
+          if (f) setBlockColor(ctx, k, &strip, 0, 255, 0);
+#endif
+        }
+        else if (isAlley(ctx, k, i))
+        {
+          textcolor(31);
+#ifdef MAZEIII
+          if (f) setBlockColor(ctx, k, &strip, 255, 0, 0);
+#endif
+        }
+        printf("%c", pipeList[getCell(ctx, k, i) & BITSLICE_0x0F]);
+        textcolor(37);
+      }
+      printf("\n");
+#ifdef MAZEIII
+      if (f) writeImageRow(ctx, &strip, i, f);
+#endif
+    }
+
+#ifdef MAZEIII
+    if (f)
+    {
+      fclose(f);
+      free(strip.image);
+    }
+#endif
+  }
+  printf("\n");
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to work with,                         */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function is called when the maze needs to be freed.   */
+/*Makes sure there is actually an active maze available. If  */
+/*  there is, it frees the block holding the maze and its    */
+/*  cells.                                                   */
+/*************************************************************/
+void mazeFree_Ctx(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+
+  if (maze)
+  {
+    alignedFree(maze);
+    ctx->maze = NULL;
+  }
+}
+
+/*************************************************************/
+/*No inputs.                                                 */
+/*Returns a new generation context, or NULL if it could not  */
+/*  be allocated.                                            */
+/*This function creates a context for the reentrant API.     */
+/*The context starts out zeroed, which is the same state the */
+/*  shared context used by mazeGenerate starts out in.       */
+/*************************************************************/
+maze_gen_ctx_t *mazeCtxCreate()
+{
+  return (maze_gen_ctx_t*)calloc(1, sizeof(maze_gen_ctx_t));
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in,                                                      */
+/*  context to destroy,                                      */
+/*  can be NULL.                                             */
+/*No return.                                                 */
+/*This function frees a context created by mazeCtxCreate     */
+/*  along with its maze and generation stack.                */
+/*************************************************************/
+void mazeCtxDestroy(maze_gen_ctx_t *ctx)
+{
+  if (ctx)
+  {
+    mazeFree_Ctx(ctx);
+    free(ctx->frameStack);
+    free(ctx->visitedBits);
+    free(ctx->goalBits);
+    free(ctx->sets);
+    free(ctx->edges);
+    free(ctx->edgeBranches);
+    mazeTraceFree(ctx->stepTrace);
+    free(ctx);
+  }
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to seed,                                         */
+/*  must not be NULL.                                        */
+/*unsigned int seed:                                         */
+/*  in,                                                      */
+/*  seed for the next maze,                                  */
+/*  can be any value.                                        */
+/*No return.                                                 */
+/*This function sets the seed the next mazeGenerate_Ctx call */
+/*  will use. The same seed and parameters always produce    */
+/*  the same maze, so passing in a maze's seed field with    */
+/*  its parameters rebuilds it.                              */
+/*************************************************************/
+void mazeCtxSeed(maze_gen_ctx_t *ctx, unsigned int seed)
+{
+  ctx->bSeeded = TRUE;
+  ctx->nextSeed = seed;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to change,                                       */
+/*  must not be NULL.                                        */
+/*int bPacked:                                               */
+/*  in,                                                      */
+/*  TRUE to store two cells per byte,                        */
+/*  FALSE (the default) for one cell per byte.               */
+/*No return.                                                 */
+/*This function picks the storage used by mazes generated    */
+/*  from now on. Packed mazes halve the memory taken by      */
+/*  their walls. Like every maze their VISITED and GOAL      */
+/*  flags live in the context while it works on them.        */
+/*************************************************************/
+void mazeCtxSetPacked(maze_gen_ctx_t *ctx, int bPacked)
+{
+  ctx->bPacked = bPacked ? TRUE : FALSE;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to change,                                       */
+/*  must not be NULL.                                        */
+/*int algorithm:                                             */
+/*  in,                                                      */
+/*  one of the MAZE_ALGO_* values,                           */
+/*  anything else is ignored.                                */
+/*No return.                                                 */
+/*This function picks the engine used by mazeGenerate_Ctx    */
+/*  from now on. Every engine lays out the same alleys and   */
+/*  leaves a maze that mazeSolve and mazePrint can use.      */
+/*************************************************************/
+void mazeCtxSetAlgorithm(maze_gen_ctx_t *ctx, int algorithm)
+{
+  if (algorithm >= 0 && algorithm < MAZE_NUM_ALGOS)
+  {
+    ctx->algorithm = (char)algorithm;
+  }
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to change,                                       */
+/*  must not be NULL.                                        */
+/*int numThreads:                                            */
+/*  in,                                                      */
+/*  number of threads MAZE_ALGO_TILED carves with,           */
+/*  0 or less uses one per core.                             */
+/*No return.                                                 */
+/*The other engines always run on the calling thread alone.  */
+/*  The tiled engine builds the same maze for any number of  */
+/*  threads.                                                 */
+/*************************************************************/
+void mazeCtxSetThreads(maze_gen_ctx_t *ctx, int numThreads)
+{
+  ctx->numThreads = numThreads > 0 ? numThreads : 0;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to change,                                       */
+/*  must not be NULL.                                        */
+/*int bQuiet:                                                */
+/*  in,                                                      */
+/*  TRUE to leave out the debug output,                      */
+/*  FALSE to print it (the default).                         */
+/*No return.                                                 */
+/*Contexts used off the main thread should be quiet, so      */
+/*  their output does not land in the middle of the game's.  */
+/*  Errors are still printed.                                */
+/*************************************************************/
+void mazeCtxSetQuiet(maze_gen_ctx_t *ctx, int bQuiet)
+{
+  ctx->bQuiet = bQuiet ? TRUE : FALSE;
+}
+
+/*************************************************************/
+/*const char *name:                                          */
+/*  in,                                                      */
+/*  name of an algorithm, such as "kruskal",                 */
+/*  must not be NULL.                                        */
+/*Returns the MAZE_ALGO_* value with that name, or INVALID.  */
+/*************************************************************/
+int mazeFindAlgorithm(const char *name)
+{
+  int i;
+
+  for (i = 0; i < MAZE_NUM_ALGOS; i++)
+  {
+    if (!strcmp(mazeAlgorithms[i].name, name)) return i;
+  }
+
+  return INVALID;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to take the maze from,                           */
+/*  must not be NULL.                                        */
+/*Returns the context's maze, or NULL if it has none.        */
+/*This function hands the maze over to the caller, who must  */
+/*  free it with mazeRelease. The context keeps its scratch  */
+/*  memory but drops the maze, so the next mazeGenerate_Ctx  */
+/*  call allocates a fresh maze.                             */
+/*************************************************************/
+maze_t *mazeCtxDetach(maze_gen_ctx_t *ctx)
+{
+  maze_t *maze = ctx->maze;
+
+  ctx->maze = NULL;
+
+  return maze;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to move the maze into,                           */
+/*  must not be NULL.                                        */
+/*maze_gen_ctx_t *from:                                      */
+/*  in/out,                                                  */
+/*  context that generated the maze,                         */
+/*  must have a maze and must not be ctx.                    */
+/*Returns the maze, which now belongs to ctx.                */
+/*This function moves a finished maze over to another        */
+/*  context along with everything solving and printing it    */
+/*  needs (its alleys, probes and flags), as if ctx had      */
+/*  generated it. ctx's old maze goes the other way and is   */
+/*  freed, and from keeps its scratch memory.                */
+/*  It lets a maze be built on another thread and then used  */
+/*  through the shared context.                              */
+/*************************************************************/
+maze_t *mazeAdopt_Ctx(maze_gen_ctx_t *ctx, maze_gen_ctx_t *from)
+{
+  maze_gen_ctx_t old = *ctx;
+
+  ctx->maze = from->maze;
+  memcpy(ctx->alleymap_X, from->alleymap_X, sizeof(ctx->alleymap_X));
+  memcpy(ctx->alleymap_Y, from->alleymap_Y, sizeof(ctx->alleymap_Y));
+  ctx->mWidth = from->mWidth;
+  ctx->mHeight = from->mHeight;
+  memcpy(ctx->probe, from->probe, sizeof(ctx->probe));
+  ctx->visitedBits = from->visitedBits;
+  ctx->goalBits = from->goalBits;
+  ctx->flagBytes = from->flagBytes;
+  ctx->flagWidth = from->flagWidth;
+
+  from->maze = old.maze;
+  from->visitedBits = old.visitedBits;
+  from->goalBits = old.goalBits;
+  from->flagBytes = old.flagBytes;
+  from->flagWidth = old.flagWidth;
+  mazeFree_Ctx(from);
+
+  return ctx->maze;
+}
+
+/*************************************************************/
+/*maze_t *maze:                                              */
+/*  in,                                                      */
+/*  maze to free,                                            */
+/*  can be NULL.                                             */
+/*No return.                                                 */
+/*This function frees a maze returned by mazeCtxDetach or    */
+/*  mazeGenerateBatch.                                       */
+/*************************************************************/
+void mazeRelease(maze_t *maze)
+{
+  alignedFree(maze);
+}
+
+/*************************************************************/
+/*const maze_t *maze:                                        */
+/*  in,                                                      */
+/*  maze to copy,                                            */
+/*  must not be NULL.                                        */
+/*Returns a copy that must be freed with mazeRelease, or     */
+/*  NULL if there was not enough memory.                     */
+/*The maze and its cells are one block, so this is a single  */
+/*  memcpy plus pointing the copy at its own cells.          */
+/*************************************************************/
+maze_t *mazeCopy(const maze_t *maze)
+{
+  size_t size = MAZE_BLOCK_SIZE(maze->stride, maze->height);
+  maze_t *copy = (maze_t*)alignedAlloc(size);
+
+  if (!copy) return NULL;
+  memcpy(copy, maze, size);
+  copy->cells = (uint8*)copy + MAZE_CELLS_OFFSET(maze->stride);
+
+  return copy;
+}
+
+/*************************************************************/
+/*const maze_t *maze:                                        */
+/*  in,                                                      */
+/*  maze to look at,                                         */
+/*  must not be NULL.                                        */
+/*Returns the number of dead ends (cells with exactly one    */
+/*  opening), or -1 if there was not enough memory. Openings */
+/*  through the border at the start and exit do not count,   */
+/*  which matches the deadEnds of ms_Analyze.                */
+/*This function loads the walls into bit planes, one bit per */
+/*  cell for each direction, and counts the dead ends a      */
+/*  whole vector of cells at a time.                         */
+/*************************************************************/
+long long mazeCountDeadEnds(const maze_t *maze)
+{
+  bitplane_t *bp = bp_Create(maze->width, maze->height);
+  long long count;
+
+  if (!bp) return -1;
+  bp_LoadMaze(bp, maze);
+  count = bp_CountDeadEnds(bp);
+  bp_Free(bp);
+
+  return count;
+}
+
+/*************************************************************/
+/*void *arg:                                                 */
+/*  in/out,                                                  */
+/*  the mazeBatch_t being worked on,                         */
+/*  must not be NULL.                                        */
+/*No return.                                                 */
+/*This function is run by every thread of a batch, including */
+/*  the one that called mazeGenerateBatch.                   */
+/*Each worker keeps one context for its whole run, reseeds   */
+/*  it for every maze it claims and detaches the result into */
+/*  the output array.                                        */
+/*************************************************************/
+void batchWorker(void *arg)
+{
+  mazeBatch_t *batch = (mazeBatch_t*)arg;
+  maze_gen_ctx_t *ctx = mazeCtxCreate();
+  const maze_params_t *params;
+  int i;
+
+  if (!ctx) return;
+  ctx->bQuiet = TRUE;
+  mazeCtxSetThreads(ctx, 1); // the batch already has every core busy
+
+  while ((i = th_AtomicIncrement(&batch->next) - 1) < batch->count)
+  {
+    params = batch->bSeedRange ? batch->params : &batch->params[i];
+    mazeCtxSetPacked(ctx, params->bPacked);
+    mazeCtxSetAlgorithm(ctx, params->algorithm);
+    mazeCtxSeed(ctx, batch->bSeedRange ? batch->firstSeed + i :
+      params->seed);
+
+    if (mazeGenerate_Ctx(ctx, params->width, params->height,
+      params->wayPointX, params->wayPointY, params->wayPointAlleyLength,
+      params->wayPointDirectionPercent, params->straightProbability, FALSE))
+    {
+      batch->mazes[i] = mazeCtxDetach(ctx);
+    }
+  }
+
+  mazeCtxDestroy(ctx);
+}
+
+/*************************************************************/
+/*mazeBatch_t *batch:                                        */
+/*  in/out,                                                  */
+/*  batch to run,                                            */
+/*  must have its mazes array allocated.                     */
+/*int numThreads:                                            */
+/*  in,                                                      */
+/*  number of threads to use,                                */
+/*  0 or less uses one per core.                             */
+/*Returns the number of mazes that were generated.           */
+/*This function starts numThreads - 1 extra threads and      */
+/*  works on the batch from the calling thread as well, so a */
+/*  single thread batch never creates a thread. If a thread  */
+/*  cannot be created the remaining ones pick up its share.  */
+/*************************************************************/
+int runBatch(mazeBatch_t *batch, int numThreads)
+{
+  int i, numMazes = 0;
+
+  for (i = 0; i < batch->count; i++)
+  {
+    batch->mazes[i] = NULL;
+  }
+  batch->next = 0;
+
+  if (numThreads <= 0) numThreads = th_NumCores();
+  if (numThreads > batch->count) numThreads = batch->count;
+  runWorkers(batchWorker, batch, numThreads);
+
+  for (i = 0; i < batch->count; i++)
+  {
+    if (batch->mazes[i]) numMazes++;
+  }
+
+  return numMazes;
+}
+
+/*************************************************************/
+/*const maze_params_t *params:                               */
+/*  in,                                                      */
+/*  one set of parameters (and seed) for each maze,          */
+/*  must have count elements.                                */
+/*int count:                                                 */
+/*  in,                                                      */
+/*  number of mazes to generate.                             */
+/*maze_t **mazes:                                            */
+/*  out,                                                     */
+/*  receives the mazes, NULL where one could not be built,   */
+/*  must have count elements.                                */
+/*int numThreads:                                            */
+/*  in,                                                      */
+/*  number of threads to use,                                */
+/*  0 or less uses one per core.                             */
+/*Returns the number of mazes that were generated.           */
+/*Each maze is generated from its own seed, so the results   */
+/*  do not depend on numThreads. Free them with mazeRelease. */
+/*************************************************************/
+int mazeGenerateBatch(const maze_params_t *params, int count,
+  maze_t **mazes, int numThreads)
+{
+  mazeBatch_t batch;
+
+  if (!params || !mazes || count <= 0) return 0;
+  batch.params = params;
+  batch.count = count;
+  batch.bSeedRange = FALSE;
+  batch.firstSeed = 0;
+  batch.mazes = mazes;
+
+  return runBatch(&batch, numThreads);
+}
+
+/*************************************************************/
+/*const maze_params_t *params:                               */
+/*  in,                                                      */
+/*  parameters shared by every maze, seed is ignored,        */
+/*  must not be NULL.                                        */
+/*unsigned int firstSeed:                                    */
+/*  in,                                                      */
+/*  seed of the first maze, maze i uses firstSeed + i.       */
+/*int count:                                                 */
+/*  in,                                                      */
+/*  number of mazes to generate.                             */
+/*maze_t **mazes:                                            */
+/*  out,                                                     */
+/*  receives the mazes, NULL where one could not be built,   */
+/*  must have count elements.                                */
+/*int numThreads:                                            */
+/*  in,                                                      */
+/*  number of threads to use,                                */
+/*  0 or less uses one per core.                             */
+/*Returns the number of mazes that were generated.           */
+/*This function is mazeGenerateBatch for a range of seeds.   */
+/*************************************************************/
+int mazeGenerateSeedRange(const maze_params_t *params,
+  unsigned int firstSeed, int count, maze_t **mazes, int numThreads)
+{
+  mazeBatch_t batch;
+
+  if (!params || !mazes || count <= 0) return 0;
+  batch.params = params;
+  batch.count = count;
+  batch.bSeedRange = TRUE;
+  batch.firstSeed = firstSeed;
+  batch.mazes = mazes;
+
+  return runBatch(&batch, numThreads);
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to draw random numbers from,          */
+/*  must not be NULL.                                        */
+/*int width:                                                 */
+/*  in,                                                      */
+/*  width of the maze,                                       */
+/*  must be between 3 and MAZE_STREAM_MAX_SIZE.              */
+/*int height:                                                */
+/*  in,                                                      */
+/*  height of the maze,                                      */
+/*  must be between 3 and MAZE_STREAM_MAX_SIZE.              */
+/*double joinProbability:                                    */
+/*  in,                                                      */
+/*  chance that two cells side by side are joined,           */
+/*  must be from 0.0 to 1.0.                                 */
+/*maze_row_func_t func:                                      */
+/*  in,                                                      */
+/*  called with each row in order,                           */
+/*  must not be NULL.                                        */
+/*void *arg:                                                 */
+/*  in,                                                      */
+/*  passed through to func,                                  */
+/*  can be anything.                                         */
+/*Returns TRUE if every row was handed to func, FALSE if the */
+/*  inputs were invalid, memory ran out or func stopped it.  */
+/*This function generates a perfect maze one row at a time   */
+/*  with Eller's Algorithm, so only the current row is ever  */
+/*  held in memory.                                          */
+/*Every cell of a row belongs to a set of cells that are     */
+/*  already connected. Cells beside each other in different  */
+/*  sets are joined at random (always on the last row), then */
+/*  each set opens south from at least one of its cells,     */
+/*  picked at random, and more at random. Cells below an     */
+/*  opening carry their set into the next row and the rest   */
+/*  start new sets. The sets are a union-find over ids that  */
+/*  are renumbered every row, so they never need more than   */
+/*  width entries. The entrance is opened to the north on    */
+/*  the first row and the exit to the south on the last.     */
+/*The seed comes from mazeCtxSeed the same way it does for   */
+/*  mazeGenerate_Ctx, but the context's maze is not touched. */
+/*************************************************************/
+int mazeStream_Ctx(maze_gen_ctx_t *ctx, int width, int height,
+  double joinProbability, maze_row_func_t func, void *arg)
+{
+  int *set, *parent, *seen, *pick;
+  uint8 *cells, *down, *hasDown;
+  unsigned long long joinLimit;
+  unsigned int downBits = 0;
+  int x, y, a, b, root, numSets, bLastRow;
+  void *block;
+
+  if (width < 3 || width > MAZE_STREAM_MAX_SIZE) return FALSE;
+  else if (height < 3 || height > MAZE_STREAM_MAX_SIZE) return FALSE;
+  else if (joinProbability < 0 || joinProbability > 1.0) return FALSE;
+  else if (!func) return FALSE;
+
+  block = malloc((sizeof(int) * 4 + 3) * (size_t)width);
+  if (!block) return FALSE;
+  set = (int*)block;
+  parent = set + width;
+  seen = parent + width;
+  pick = seen + width;
+  cells = (uint8*)(pick + width);
+  down = cells + width;
+  hasDown = down + width;
+
+  seedRandom(ctx, nextMazeSeed(ctx));
+  joinLimit = (unsigned long long)(joinProbability * 4294967296.0);
+
+  for (x = 0; x < width; x++)
+  {
+    set[x] = x;
+    cells[x] = NO_DIRECTIONS;
+  }
+  cells[ctxRandRange(ctx, width)] |= NORTH;
+
+  for (y = 0; y < height; y++)
+  {
+    bLastRow = y == height - 1;
+    for (x = 0; x < width; x++)
+    {
+      parent[x] = x;
+      seen[x] = 0;
+      hasDown[x] = FALSE;
+    }
+
+    for (x = 0; x < width - 1; x++)
+    {
+      a = findSet(parent, set[x]);
+      b = findSet(parent, set[x + 1]);
+      if (a != b && (bLastRow || ctxRand(ctx) < joinLimit))
+      {
+        parent[a] = b;
+        cells[x] |= EAST;
+        cells[x + 1] |= WEST;
+      }
+    }
+
+    if (bLastRow)
+    {
+      cells[ctxRandRange(ctx, width)] |= SOUTH;
+      if (!func(cells, width, y, arg)) break;
+      continue;
+    }
+
+    // pick one cell of each set at random (reservoir sampling) in case
+    // none of them open south by chance
+    for (x = 0; x < width; x++)
+    {
+      root = set[x] = findSet(parent, set[x]);
+      if (!(x & 31)) downBits = ctxRand(ctx); // one draw for 32 cells
+      down[x] = (uint8)(downBits >> (x & 31) & 1);
+      if (down[x]) hasDown[root] = TRUE;
+      if (!ctxRandRange(ctx, ++seen[root])) pick[root] = x;
+    }
+    for (x = 0; x < width; x++)
+    {
+      if (!hasDown[set[x]] && pick[set[x]] == x) down[x] = TRUE;
+      if (down[x]) cells[x] |= SOUTH;
+    }
+
+    if (!func(cells, width, y, arg)) break;
+
+    // renumber the sets for the next row, reusing pick for the new ids
+    numSets = 0;
+    for (x = 0; x < width; x++)
+    {
+      pick[x] = INVALID;
+    }
+    for (x = 0; x < width; x++)
+    {
+      if (down[x])
+      {
+        if (pick[set[x]] == INVALID) pick[set[x]] = numSets++;
+        set[x] = pick[set[x]];
+        cells[x] = NORTH;
+      }
+      else
+      {
+        set[x] = numSets++;
+        cells[x] = NO_DIRECTIONS;
+      }
+    }
+  }
+
+  free(block);
+
+  return y == height;
+}
+
+/*************************************************************/
+/*const uint8 *row:                                          */
+/*  in,                                                      */
+/*  openings of each cell in the row,                        */
+/*  must have width elements.                                */
+/*int width:                                                 */
+/*  in,                                                      */
+/*  number of cells in the row.                              */
+/*int y:                                                     */
+/*  in,                                                      */
+/*  row number, not used.                                    */
+/*void *arg:                                                 */
+/*  in/out,                                                  */
+/*  the mazeStreamFile_t being written,                      */
+/*  must not be NULL.                                        */
+/*Returns TRUE if the row was written, FALSE if not.         */
+/*This function is the maze_row_func_t used by               */
+/*  mazeStreamToFile_Ctx. It packs the row two cells to a    */
+/*  byte and appends it to the file.                         */
+/*************************************************************/
+int writeStreamRow(const uint8 *row, int width, int y, void *arg)
+{
+  mazeStreamFile_t *out = (mazeStreamFile_t*)arg;
+  size_t rowBytes = ((size_t)width + 1) / 2;
+  int x;
+
+  (void)y; // the rows arrive in order, so each one is simply appended
+  memset(out->packed, 0, rowBytes);
+  for (x = 0; x < width; x++)
+  {
+    out->packed[x >> 1] |= (row[x] & BITSLICE_0x0F) << MAZE_NIBBLE_SHIFT(x);
+  }
+
+  return fwrite(out->packed, 1, rowBytes, out->file) == rowBytes;
+}
+
+/*************************************************************/
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  generation context to draw random numbers from,          */
+/*  must not be NULL.                                        */
+/*const char *path:                                          */
+/*  in,                                                      */
+/*  file to create,                                          */
+/*  must not be NULL.                                        */
+/*int width, int height, double joinProbability:             */
+/*  in,                                                      */
+/*  see mazeStream_Ctx.                                      */
+/*Returns TRUE if the whole maze was written, FALSE if not.  */
+/*This function streams a maze straight to disk. The file is */
+/*  height rows of (width + 1) / 2 bytes with no header, two */
+/*  cells to a byte and the even column in the low nibble,   */
+/*  which is the same layout as a packed maze's rows.        */
+/*************************************************************/
+int mazeStreamToFile_Ctx(maze_gen_ctx_t *ctx, const char *path,
+  int width, int height, double joinProbability)
+{
+  mazeStreamFile_t out;
+  int bDone;
+
+  if (width < 3 || width > MAZE_STREAM_MAX_SIZE) return FALSE;
+  out.packed = (uint8*)malloc(((size_t)width + 1) / 2);
+  if (!out.packed) return FALSE;
+  out.file = fopen(path, "wb");
+  if (!out.file)
+  {
+    free(out.packed);
+    return FALSE;
+  }
+
+  bDone = mazeStream_Ctx(ctx, width, height, joinProbability,
+    writeStreamRow, &out);
+
+  if (fclose(out.file)) bDone = FALSE;
+  free(out.packed);
+
+  return bDone;
+}
+
+/*************************************************************/
+/*unsigned int seed:                                         */
+/*  in,                                                      */
+/*  seed of the lazy maze.                                   */
+/*int salt:                                                  */
+/*  in,                                                      */
+/*  LAZY_SALT_* of the decision being made.                  */
+/*int a, int b:                                              */
+/*  in,                                                      */
+/*  what the decision is about, such as a chunk's column     */
+/*  and row.                                                 */
+/*Returns a hash of all four.                                */
+/*Lazy mazes must come out the same whatever order they are  */
+/*  explored in, so nothing in them draws from a stream.     */
+/*  Every decision is a hash of where it is made instead     */
+/*  (splitmix64 finalizer rounds).                           */
+/*************************************************************/
+unsigned int lazyHash(unsigned int seed, int salt, int a, int b)
+{
+  unsigned long long h = (unsigned long long)seed << 3 | salt;
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    if (i == 0) h ^= (unsigned int)a;
+    else if (i == 1) h ^= (unsigned int)b;
+  }
+
+  return (unsigned int)h;
+}
+
+/*************************************************************/
+/*lazyChunk_t *table:                                        */
+/*  in,                                                      */
+/*  chunk table to search,                                   */
+/*  must have at least one empty slot.                       */
+/*int tableSize:                                             */
+/*  in,                                                      */
+/*  number of slots, a power of two.                         */
+/*long long key:                                             */
+/*  in,                                                      */
+/*  key of the chunk to find.                                */
+/*Returns the slot holding the chunk, or the empty slot it   */
+/*  would go in.                                             */
+/*************************************************************/
+lazyChunk_t *findChunk(lazyChunk_t *table, int tableSize, long long key)
+{
+  lazyChunk_t *chunk = &table[lazyHash(0, LAZY_SALT_SLOT, (int)key,
+    (int)(key >> 32)) & (tableSize - 1)];
+
+  while (chunk->key && chunk->key != key)
+  {
+    chunk = chunk == &table[tableSize - 1] ? table : chunk + 1;
+  }
+
+  return chunk;
+}
+
+/*************************************************************/
+/*maze_lazy_t *lazy:                                         */
+/*  in,                                                      */
+/*  lazy maze to look at,                                    */
+/*  must not be NULL.                                        */
+/*int cx, int cy:                                            */
+/*  in,                                                      */
+/*  column and row of a chunk,                               */
+/*  must be in bounds.                                       */
+/*Returns the index into DIRECTION_LIST of the neighbor the  */
+/*  chunk is joined to, or INVALID for the top left chunk.   */
+/*The chunks form a binary tree: each one joins the chunk    */
+/*  above or the chunk to its left, picked by hash. The top  */
+/*  row can only go left and the left column only up, so     */
+/*  every chunk leads back to the top left one. Only the     */
+/*  chunk itself decides, which is what lets any chunk be    */
+/*  carved without looking at the rest of the maze.          */
+/*************************************************************/
+int lazyJoin(maze_lazy_t *lazy, int cx, int cy)
+{
+  if (!cx && !cy) return INVALID;
+  else if (!cy) return 3;
+  else if (!cx) return 0;
+  return lazyHash(lazy->seed, LAZY_SALT_TREE, cx, cy) & 1 ? 0 : 3;
+}
+
+/*************************************************************/
+/*maze_lazy_t *lazy:                                         */
+/*  in,                                                      */
+/*  lazy maze to look at,                                    */
+/*  must not be NULL.                                        */
+/*int cx, int cy:                                            */
+/*  in,                                                      */
+/*  column and row of a chunk,                               */
+/*  must be in bounds and not the top left chunk.            */
+/*int length:                                                */
+/*  in,                                                      */
+/*  number of cells along the side the chunk joins through.  */
+/*Returns how far along that side the passage is.            */
+/*The chunk and its neighbor both get the passage from here, */
+/*  so it lines up whichever one is carved first.            */
+/*************************************************************/
+int lazyDoor(maze_lazy_t *lazy, int cx, int cy, int length)
+{
+  return (int)(lazyHash(lazy->seed, LAZY_SALT_DOOR, cx, cy) %
+    (unsigned int)length);
+}
+
+/*************************************************************/
+/*maze_lazy_t *lazy:                                         */
+/*  in/out,                                                  */
+/*  lazy maze to carve in,                                   */
+/*  must not be NULL.                                        */
+/*int cx, int cy:                                            */
+/*  in,                                                      */
+/*  column and row of the chunk,                             */
+/*  must be in bounds and not carved yet.                    */
+/*Returns the chunk, or NULL if there was not enough memory. */
+/*This function carves one chunk. The inside is a perfect    */
+/*  maze from the Kruskal engine, seeded from the chunk's    */
+/*  hash. Then the passage to the chunk it joins is opened,  */
+/*  along with the passages from the right and lower         */
+/*  neighbors if they join this one, and the start and exit  */
+/*  if they are in it. Every chunk is a tree and the chunks  */
+/*  are joined as a tree by one passage each, so the whole   */
+/*  maze is perfect: every cell that has been shown leads    */
+/*  to the exit, however little of the maze is carved.       */
+/*The table is kept at most half full and doubled as needed. */
+/*************************************************************/
+lazyChunk_t *carveChunk(maze_lazy_t *lazy, int cx, int cy)
+{
+  struct maze_chunks_s *chunks = lazy->chunks;
+  maze_gen_ctx_t *ctx = chunks->ctx;
+  lazyChunk_t *table, *chunk;
+  long long key = (long long)cy * chunks->chunksX + cx + 1;
+  int width = MIN(LAZY_CHUNK_SIZE, lazy->width - cx * LAZY_CHUNK_SIZE);
+  int height = MIN(LAZY_CHUNK_SIZE, lazy->height - cy * LAZY_CHUNK_SIZE);
+  int i, x, y;
+  uint8 *cells;
+
+  if ((lazy->numChunks + 1) * 2 > chunks->tableSize)
+  {
+    table = (lazyChunk_t*)calloc(chunks->tableSize * 2, sizeof(lazyChunk_t));
+    if (!table) return NULL;
+    for (i = 0; i < chunks->tableSize; i++)
+    {
+      if (!chunks->table[i].key) continue;
+      *findChunk(table, chunks->tableSize * 2, chunks->table[i].key) =
+        chunks->table[i];
+    }
+    free(chunks->table);
+    chunks->table = table;
+    chunks->tableSize *= 2;
+    chunks->last = NULL;
+  }
+
+  cells = (uint8*)malloc(LAZY_CHUNK_SIZE * LAZY_CHUNK_SIZE);
+  if (!cells) return NULL;
+
+  clearCells(ctx->maze);
+  seedRandom(ctx, lazyHash(lazy->seed, LAZY_SALT_CARVE, cx, cy));
+  if (!kruskalRegion(ctx, 0, 0, width, height))
+  {
+    free(cells);
+    return NULL;
+  }
+  for (y = 0; y < LAZY_CHUNK_SIZE; y++)
+  {
+    for (x = 0; x < LAZY_CHUNK_SIZE; x++)
+    {
+      cells[y * LAZY_CHUNK_SIZE + x] = MAZE_GET(ctx->maze, x, y);
+    }
+  }
+
+  i = lazyJoin(lazy, cx, cy);
+  if (i == 0) cells[lazyDoor(lazy, cx, cy, width)] |= NORTH;
+  else if (i == 3)
+  {
+    cells[lazyDoor(lazy, cx, cy, height) * LAZY_CHUNK_SIZE] |= WEST;
+  }
+  if (cx + 1 < chunks->chunksX && lazyJoin(lazy, cx + 1, cy) == 3)
+  {
+    cells[lazyDoor(lazy, cx + 1, cy, height) * LAZY_CHUNK_SIZE +
+      width - 1] |= EAST;
+  }
+  if (cy + 1 < chunks->chunksY && lazyJoin(lazy, cx, cy + 1) == 0)
+  {
+    cells[(height - 1) * LAZY_CHUNK_SIZE +
+      lazyDoor(lazy, cx, cy + 1, width)] |= SOUTH;
+  }
+  if (!cy && lazy->startX / LAZY_CHUNK_SIZE == cx)
+  {
+    cells[lazy->startX % LAZY_CHUNK_SIZE] |= NORTH;
+  }
+  if (cy + 1 == chunks->chunksY && lazy->endX / LAZY_CHUNK_SIZE == cx)
+  {
+    cells[(height - 1) * LAZY_CHUNK_SIZE + lazy->endX % LAZY_CHUNK_SIZE] |=
+      SOUTH;
+  }
+
+  chunk = findChunk(chunks->table, chunks->tableSize, key);
+  chunk->key = key;
+  chunk->cells = cells;
+  lazy->numChunks++;
+
+  return chunk;
+}
+
+/*************************************************************/
+/*int width:                                                 */
+/*  in,                                                      */
+/*  width of the maze,                                       */
+/*  must be between 3 and MAZE_STREAM_MAX_SIZE.              */
+/*int height:                                                */
+/*  in,                                                      */
+/*  height of the maze,                                      */
+/*  must be between 3 and MAZE_STREAM_MAX_SIZE.              */
+/*unsigned int seed:                                         */
+/*  in,                                                      */
+/*  seed the whole maze follows from,                        */
+/*  can be any value.                                        */
+/*Returns the new lazy maze, or NULL if the inputs were      */
+/*  invalid or there was not enough memory.                  */
+/*This function sets up a maze that is carved a chunk at a   */
+/*  time, the first time anything in the chunk is looked at  */
+/*  (see carveChunk). Nothing is carved yet, so it takes     */
+/*  the same time and memory for any size. The start is on   */
+/*  the top row and the exit on the bottom row, both picked  */
+/*  by hash. The maze only depends on the seed, never on     */
+/*  the order it is explored in.                             */
+/*************************************************************/
+maze_lazy_t *mazeLazyCreate(int width, int height, unsigned int seed)
+{
+  maze_lazy_t *lazy;
+  struct maze_chunks_s *chunks;
+
+  if (width < 3 || width > MAZE_STREAM_MAX_SIZE || height < 3 ||
+    height > MAZE_STREAM_MAX_SIZE)
+  {
+    return NULL;
   }
 
-  maze->data[maze->startX][maze->startY] |= NORTH;
+  lazy = (maze_lazy_t*)calloc(1, sizeof(maze_lazy_t) +
+    sizeof(struct maze_chunks_s));
+  if (!lazy) return NULL;
+  chunks = (struct maze_chunks_s*)(lazy + 1);
+  lazy->chunks = chunks;
+  lazy->width = width;
+  lazy->height = height;
+  lazy->seed = seed;
+  lazy->startX = lazyHash(seed, LAZY_SALT_ENDS, 0, 0) % width;
+  lazy->startY = 0;
+  lazy->endX = lazyHash(seed, LAZY_SALT_ENDS, 1, 0) % width;
+  lazy->endY = height - 1;
+  chunks->chunksX = (width + LAZY_CHUNK_SIZE - 1) / LAZY_CHUNK_SIZE;
+  chunks->chunksY = (height + LAZY_CHUNK_SIZE - 1) / LAZY_CHUNK_SIZE;
 
-  if (bCallSolve)
+  // a packed scratch maze
+  chunks->ctx = mazeCtxCreate();
+  chunks->table = (lazyChunk_t*)calloc(LAZY_MIN_TABLE, sizeof(lazyChunk_t));
+  chunks->tableSize = LAZY_MIN_TABLE;
+  if (chunks->ctx)
   {
-    mazeSolve();
-    sliceBits_0x0F();
+    chunks->ctx->bQuiet = TRUE;
+    chunks->ctx->bPacked = TRUE;
+  }
+  if (!chunks->ctx || !chunks->table ||
+    !allocateMazeData_Ctx(chunks->ctx, LAZY_CHUNK_SIZE, LAZY_CHUNK_SIZE))
+  {
+    mazeLazyFree(lazy);
+    return NULL;
   }
 
-  return maze;
+  return lazy;
 }
 
 /*************************************************************/
-/*short x:                                                   */
-/*  in,                                                      */
-/*  current x-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*short y:                                                   */
-/*  in,                                                      */
-/*  current y-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*Returns TRUE if the end has been found                     */
-/*This function calls itself recursively to solve the maze.  */
-/*Checks to see if the current cell is the end. If not       */
-/*  it loops through all 4 possible directions and sees      */
-/*  if there are unvisited cells next to them. If there      */
-/*  are it calls itself with the new x and y coordinates.    */
-/*  This continues until the whole maze is solved.           */
+/*maze_lazy_t *lazy:                                         */
+/*  in/out,                                                  */
+/*  lazy maze to free,                                       */
+/*  can be NULL.                                             */
+/*No return.                                                 */
+/*This function frees every carved chunk along with the      */
+/*  lazy maze itself.                                        */
 /*************************************************************/
-int mazeSolve_Recursive(short x, short y, char direction)
+void mazeLazyFree(maze_lazy_t *lazy)
 {
-  if (recursionLevel > MAX_STACK) return FALSE;
+  struct maze_chunks_s *chunks;
+  int i;
 
-  recursionLevel++;
-  char i;
-  maze->data[x][y] |= VISITED; // set this cell to visited
+  if (!lazy) return;
 
-  if ((i = checkForEdge(x, y)) != INVALID && bFoundWay && !bFoundExit)
+  chunks = lazy->chunks;
+  for (i = 0; chunks->table && i < chunks->tableSize; i++)
   {
-    bFoundExit = 1;
-    maze->endX = x;
-    maze->endY = y;
-    maze->data[x][y] |= GOAL | DIRECTION_LIST[i];
-    recursionLevel--;
-    return TRUE;
+    free(chunks->table[i].cells);
   }
-  else if (x == maze->wayX && y == maze->wayY && !bFoundWay)
+  free(chunks->table);
+  mazeCtxDestroy(chunks->ctx);
+  free(lazy);
+}
+
+/*************************************************************/
+/*maze_lazy_t *lazy:                                         */
+/*  in/out,                                                  */
+/*  lazy maze to look at,                                    */
+/*  must not be NULL.                                        */
+/*int x, int y:                                              */
+/*  in,                                                      */
+/*  cell to look at,                                         */
+/*  can be out of bounds.                                    */
+/*Returns the openings of the cell, carving its chunk first  */
+/*  if need be. Cells out of bounds, and cells whose chunk   */
+/*  there was no memory for, have no openings.               */
+/*************************************************************/
+uint8 mazeLazyGet(maze_lazy_t *lazy, int x, int y)
+{
+  struct maze_chunks_s *chunks = lazy->chunks;
+  lazyChunk_t *chunk = chunks->last;
+  int cx, cy;
+  long long key;
+
+  if (x < 0 || y < 0 || x >= lazy->width || y >= lazy->height)
   {
-    bFoundWay = 1;
-    maze->data[x][y] |= GOAL;
-    mazeSolve_Recursive(maze->wayX, maze->wayY, -1);
-    recursionLevel--;
-    return TRUE;
+    return NO_DIRECTIONS;
   }
 
-  for (i = 0; i < 4; i++)
+  cx = x / LAZY_CHUNK_SIZE;
+  cy = y / LAZY_CHUNK_SIZE;
+  key = (long long)cy * chunks->chunksX + cx + 1;
+  if (!chunk || chunk->key != key)
   {
-    currX = x + DIRECTION_DX[i];
-    currY = y + DIRECTION_DY[i];
+    chunk = findChunk(chunks->table, chunks->tableSize, key);
+    if (!chunk->key) chunk = carveChunk(lazy, cx, cy);
+    if (!chunk) return NO_DIRECTIONS;
+    chunks->last = chunk;
+  }
+
+  return chunk->cells[y % LAZY_CHUNK_SIZE * LAZY_CHUNK_SIZE +
+    x % LAZY_CHUNK_SIZE];
+}
+
+/*************************************************************/
+/*maze_lazy_t *lazy:                                         */
+/*  in/out,                                                  */
+/*  lazy maze to carve in,                                   */
+/*  must not be NULL.                                        */
+/*int left, int top, int right, int bottom:                  */
+/*  in,                                                      */
+/*  corners of the area to carve, inclusive,                 */
+/*  can reach out of bounds.                                 */
+/*Returns TRUE if every chunk the area touches is carved,    */
+/*  FALSE if there was not enough memory.                    */
+/*This function carves ahead of where the maze is going to   */
+/*  be looked at, such as a little past a player's view.     */
+/*************************************************************/
+int mazeLazyReveal(maze_lazy_t *lazy, int left, int top, int right,
+  int bottom)
+{
+  struct maze_chunks_s *chunks = lazy->chunks;
+  int cx, cy;
+
+  if (left < 0) left = 0;
+  if (top < 0) top = 0;
+  if (right >= lazy->width) right = lazy->width - 1;
+  if (bottom >= lazy->height) bottom = lazy->height - 1;
 
-    if (currX < 0 || currX > maze->width - 1) continue;
-    else if (currY < 0 || currY > maze->height - 1) continue;
-    else if (maze->data[currX][currY] & VISITED) continue;
-    else if (maze->data[x][y] & DIRECTION_LIST[i])
+  for (cy = top / LAZY_CHUNK_SIZE; cy <= bottom / LAZY_CHUNK_SIZE; cy++)
+  {
+    for (cx = left / LAZY_CHUNK_SIZE; cx <= right / LAZY_CHUNK_SIZE; cx++)
     {
-      if (mazeSolve_Recursive(currX, currY, DIRECTION_LIST[i]))
-      {
-        maze->data[x][y] |= GOAL;
-        recursionLevel--;
-        return TRUE;
-      }
+      if (findChunk(chunks->table, chunks->tableSize,
+        (long long)cy * chunks->chunksX + cx + 1)->key) continue;
+      if (!carveChunk(lazy, cx, cy)) return FALSE;
     }
   }
 
-  recursionLevel--;
-  return FALSE;
+  return TRUE;
 }
 
 /*************************************************************/
 /*No inputs.                                                 */
-/*No return.                                                 */
-/*This function is called when the maze needs to be solved.  */
-/*Makes sure there is actually an active maze available. If  */
-/*  there is, it calls mazeSolve_Recursive with the starting */
-/*  x and y coordinates of the maze.                         */
+/*Returns a new, empty trace, or NULL if it could not be     */
+/*  allocated.                                               */
+/*This function creates a trace to hand to mazeCtxSetTrace.  */
+/*  It comes with a quiet context of its own, the player,    */
+/*  which holds the maze as of the trace's position.         */
 /*************************************************************/
-void mazeSolve()
+maze_trace_t *mazeTraceCreate()
 {
-  const char MAX_TRIES = 10;
-  char numTries = 0;
-  bCallSolve = 0;
-  if (maze)
-  {
-    bFoundExit = 0;
+  maze_trace_t *trace = (maze_trace_t*)calloc(1, sizeof(maze_trace_t));
 
-    while (!bFoundExit && numTries < MAX_TRIES)
-    {
-      bFoundWay = 0;
-      bFoundExit = 0;
-      mazeSolve_Recursive(maze->startX, maze->startY, -1);
-      mazeSolve_Recursive(maze->wayX, maze->wayY, -1);
+  if (!trace) return NULL;
+  trace->player = mazeCtxCreate();
+  if (!trace->player)
+  {
+    free(trace);
+    return NULL;
+  }
+  trace->player->bQuiet = TRUE;
 
-      if (!bFoundExit)
-      {
-        mazeGenerate(mWidth + 1, mHeight + 1, maze->wayX + 1, maze->wayY + 1,
-          maze->alleyLen, maze->dirPercent, maze->straightProb,
-          maze->printSteps);
-      }
-      numTries++;
-    }
+  return trace;
+}
 
-    if (!bFoundExit) printf("Joel's Algorithm failed\n");
+/*************************************************************/
+/*maze_trace_t *trace:                                       */
+/*  in/out,                                                  */
+/*  trace to free,                                           */
+/*  can be NULL, must not be set on a context.               */
+/*No return.                                                 */
+/*This function frees the trace's events and its player.     */
+/*************************************************************/
+void mazeTraceFree(maze_trace_t *trace)
+{
+  if (trace)
+  {
+    free(trace->events);
+    mazeCtxDestroy(trace->player);
+    free(trace);
   }
-  bCallSolve = 1;
 }
 
-#ifdef MAZEIII
 /*************************************************************/
-/*int mazeX:                                                 */
-/*  in,                                                      */
-/*  current x-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*int mazeY:                                                 */
-/*  in,                                                      */
-/*  current y-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
+/*maze_gen_ctx_t *ctx:                                       */
+/*  in/out,                                                  */
+/*  context to record,                                       */
+/*  must not be NULL.                                        */
+/*maze_trace_t *trace:                                       */
+/*  in/out,                                                  */
+/*  trace to record into,                                    */
+/*  NULL to stop recording.                                  */
 /*No return.                                                 */
-/*This function determines what walls it needs to draw       */
-/*  for the current cell and writes them to an array.        */
-/*Loops through, checking each cell against DIRECTION_LIST[i]*/
-/*  and, if the cell contains that wall, calls the current   */
-/*  function at index i from D_FUNCS (which are mapped       */
-/*  to DIRECTION_LIST). Each function inside of D_FUNCS      */
-/*  corresponds to a specific drawing function capable       */
-/*  of drawing the desired walls. At the end, fixWalls is    */
-/*  called to eliminate extra walls so that a path is        */
-/*  established.                                             */
+/*From now on every mazeGenerate_Ctx call empties the trace  */
+/*  and logs each wall the carve opens or closes into it,    */
+/*  with a MAZE_EVENT_MARK wherever a stage of the carve     */
+/*  ends. Nothing is drawn while the maze is carved. The     */
+/*  trace is played back afterwards with mazeTraceSeek and   */
+/*  mazeTraceReplay. Tiled mazes are carved on one thread    */
+/*  while they are recorded.                                 */
 /*************************************************************/
-void writePixelBlock(int mazeX, int mazeY)
+void mazeCtxSetTrace(maze_gen_ctx_t *ctx, maze_trace_t *trace)
 {
-  int i;
+  ctx->trace = trace;
+}
 
-  for (i = 0; i < 4; i++)
+/*************************************************************/
+/*const maze_trace_t *trace:                                 */
+/*  in,                                                      */
+/*  trace to search,                                         */
+/*  must not be NULL.                                        */
+/*size_t position:                                           */
+/*  in,                                                      */
+/*  number of events to start after.                         */
+/*Returns the position just past the next MAZE_EVENT_MARK,   */
+/*  or the end of the trace if there are no more marks.      */
+/*************************************************************/
+size_t mazeTraceNextMark(const maze_trace_t *trace, size_t position)
+{
+  while (position < trace->numEvents)
   {
-    if (maze->data[mazeX][mazeY] & DIRECTION_LIST[i])
-    {
-      D_FUNCS[i](&mazeImg->image[0], mazeImg->rowSize*(mWidth + 1),
-        mazeImg->pixelHeight*(mHeight + 1), mazeX * 8, mazeY * 8);
-    }
+    if (MAZE_EVENT_KIND(trace->events[position++]) == MAZE_EVENT_MARK) break;
   }
 
-  fixWalls(&mazeImg->image[0], mazeImg->rowSize*(mWidth + 1),
-    mazeImg->pixelHeight*(mHeight + 1), mazeX * 8, mazeY * 8);
+  return position;
 }
 
 /*************************************************************/
-/*int mazeX:                                                 */
-/*  in,                                                      */
-/*  current x-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*int mazeY:                                                 */
-/*  in,                                                      */
-/*  current y-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*unsigned char r:                                           */
+/*maze_t *maze:                                              */
+/*  in/out,                                                  */
+/*  the player's maze,                                       */
+/*  must not be packed.                                      */
+/*unsigned int event:                                        */
 /*  in,                                                      */
-/*  red value for the current cell,                          */
-/*  should be [0, 255].                                      */
-/*unsigned char g:                                           */
-/*  in,                                                      */
-/*  green value for the current cell,                        */
-/*  should be [0, 255].                                      */
-/*unsigned char b:                                           */
+/*  event to play,                                           */
+/*  must have come from a maze of the same size.             */
+/*int bUndo:                                                 */
 /*  in,                                                      */
-/*  blue value for the current cell,                         */
-/*  should be [0, 255].                                      */
+/*  TRUE to take the event back instead.                     */
 /*No return.                                                 */
-/*This function colors inside the walls of the desired       */
-/*  cell using the desired color.                            */
-/*This uses a makeshift method of coloring where, when       */
-/*  a wall of r/g/b values 0/0/0 is found, bShouldColor is   */
-/*  inverted. When bShouldColor is 1, it colors. Otherwise   */
-/*  it won't color. This produces decent colored cells but   */
-/*  could definitely be better.                              */
+/*This function opens or closes one wall on both sides.      */
+/*  The start and exit lead out of the maze, so only their   */
+/*  own cell changes.                                        */
 /*************************************************************/
-void setBlockColor(int mazeX, int mazeY,
-  unsigned char r, unsigned char g, unsigned char b)
+void playEvent(maze_t *maze, unsigned int event, int bUndo)
 {
-  int x, y, k, cx, cy;
-  char bShouldColor = 0;
-  unsigned char rd, gr, bl;
+  int cell = (int)MAZE_EVENT_CELL(event);
+  int direction = MAZE_EVENT_DIRECTION(event);
+  int x = cell % maze->width, y = cell / maze->width;
+  int nx = x + DIRECTION_DX[direction], ny = y + DIRECTION_DY[direction];
+  char bNeighbor = nx >= 0 && ny >= 0 && nx < maze->width &&
+    ny < maze->height;
 
-  for (k = 0; k < 2; k++)
-  {
-    for (y = 0; y < 8; y++)
-    {
-      for (x = 0; x < 8; x++)
-      {
-        cx = !k ? x : y;
-        cy = !k ? y : x;
+  if (MAZE_EVENT_KIND(event) == MAZE_EVENT_MARK) return;
 
-        getRGB(&mazeImg->image[0], cx + (mazeX * 8), cy + (mazeY * 8),
-          mazeImg->rowSize*(mWidth + 1),
-          mazeImg->pixelHeight*(mHeight + 1),
-          &rd, &gr, &bl);
-        if (!rd && !gr && !bl) // pixel is not just white
-        {
-          bShouldColor = !bShouldColor;
-        }
-        else if (bShouldColor)
-        {
-          setRGB(&mazeImg->image[0], cx + (mazeX * 8), cy + (mazeY * 8),
-            mazeImg->rowSize*(mWidth + 1),
-            mazeImg->pixelHeight*(mHeight + 1),
-            r, g, b);
-        }
-      }
-    }
+  if ((MAZE_EVENT_KIND(event) == MAZE_EVENT_OPEN) != !!bUndo)
+  {
+    MAZE_CELL(maze, x, y) |= DIRECTION_LIST[direction];
+    if (bNeighbor) MAZE_CELL(maze, nx, ny) |= DIRECTION_MAP[direction];
+  }
+  else
+  {
+    MAZE_CELL(maze, x, y) &= ~DIRECTION_LIST[direction];
+    if (bNeighbor) MAZE_CELL(maze, nx, ny) &= ~DIRECTION_MAP[direction];
   }
 }
-#endif
 
 /*************************************************************/
-/*int x:                                                     */
-/*  in,                                                      */
-/*  current x-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*int y:                                                     */
+/*maze_trace_t *trace:                                       */
+/*  in/out,                                                  */
+/*  trace to play,                                           */
+/*  must not be NULL.                                        */
+/*size_t position:                                           */
 /*  in,                                                      */
-/*  current y-value within the maze,                         */
-/*  must not be out of bounds of the maze.                   */
-/*Returns TRUE if the current cell is part of an alley,      */
-/*  FALSE if not.                                            */
-/*This function checks to see if the current cell is         */
-/*  part of an alley.                                        */
-/*Uses simple if statements to enforce constraints that,     */
-/*  if true, indicate that the current cell is part of an    */
-/*  alley. If none of the constraints result in an entirely  */
-/*  true statement, the current cell is not part of an alley.*/
+/*  number of events that should have happened,              */
+/*  clamped to the length of the trace.                      */
+/*Returns the player's maze as it was after that many        */
+/*  events, or NULL if nothing has been recorded.            */
+/*This function scrubs the player to a new position. Every   */
+/*  event can be taken back, so it only plays (or undoes)    */
+/*  the events between the old position and the new one,     */
+/*  in either direction.                                     */
 /*************************************************************/
-int isAlley(int x, int y)
+maze_t *mazeTraceSeek(maze_trace_t *trace, size_t position)
 {
-  if (x == maze->wayX && y >= alleymap_Y[0] && y <= alleymap_Y[2])
+  maze_t *maze = trace->player->maze;
+
+  if (!maze || maze->width != trace->width ||
+    maze->height != trace->height)
   {
-    return TRUE;
+    return NULL;
   }
-  else if (y == maze->wayY && x >= alleymap_X[3] && x <= alleymap_X[1])
+  if (position > trace->numEvents) position = trace->numEvents;
+
+  while (trace->position < position)
   {
-    return TRUE;
+    playEvent(maze, trace->events[trace->position++], FALSE);
+  }
+  while (trace->position > position)
+  {
+    playEvent(maze, trace->events[--trace->position], TRUE);
   }
 
-  return FALSE;
+  return maze;
 }
 
 /*************************************************************/
-/*No inputs.                                                 */
-/*No return.                                                 */
-/*This function prints out the current color-coded maze.     */
-/*Makes sure there is actually an active maze available. If  */
-/*  there is, it loops through each cell, printing its data. */
-/*  If it is either the waypointX and Y or if it is          */
-/*  part of the goal, it will color them differently than    */
-/*  the rest of the maze.                                    */
+/*maze_trace_t *trace:                                       */
+/*  in/out,                                                  */
+/*  trace to play,                                           */
+/*  must not be NULL.                                        */
+/*size_t eventsPerFrame:                                     */
+/*  in,                                                      */
+/*  events between frames,                                   */
+/*  0 for one frame at each MAZE_EVENT_MARK.                 */
+/*Returns TRUE once every frame is out, FALSE if nothing     */
+/*  has been recorded.                                       */
+/*This function plays the trace from the start and prints    */
+/*  each frame with mazePrint_Ctx, which also writes it to   */
+/*  maze.bmp. Every event is only played once, so apart      */
+/*  from the printing itself a replay costs one step per     */
+/*  event.                                                   */
 /*************************************************************/
-void mazePrint()
+int mazeTraceReplay(maze_trace_t *trace, size_t eventsPerFrame)
 {
-  if (maze)
+  size_t position = 0;
+
+  if (!mazeTraceSeek(trace, 0)) return FALSE;
+
+  do
   {
-    int i, k;
+    if (eventsPerFrame) position += eventsPerFrame;
+    else position = mazeTraceNextMark(trace, position);
+    mazeTraceSeek(trace, position);
+    mazePrint_Ctx(trace->player);
+  } while (position < trace->numEvents);
 
-#ifdef MAZEIII
-    memset(&mazeImg->image[0], 0xFF, sizeof(unsigned char) *
-      mazeImg->pixelDataSize);
+  return TRUE;
+}
 
-    copyIntToAddress(mazeImg->imgFileSize, &header[2]);
-    copyIntToAddress(mazeImg->pixelWidth*(mWidth + 1), &header[18]);
-    copyIntToAddress(mazeImg->pixelHeight*(mHeight + 1), &header[22]);
-    copyIntToAddress(mazeImg->pixelDataSize, &header[34]);
-#endif
+//===========================================================================
+//The original entry points. Each one forwards to its _Ctx version using
+//  the shared context.
+maze_t *mazeGenerate(int width, int height,
+  int wayPointX, int wayPointY,
+  int wayPointAlleyLength,
+  double wayPointDirectionPercent,
+  double straightProbability,
+  int printAlgorithmSteps)
+{
+  return mazeGenerate_Ctx(&defaultCtx, width, height, wayPointX, wayPointY,
+    wayPointAlleyLength, wayPointDirectionPercent, straightProbability,
+    printAlgorithmSteps);
+}
 
-    printf("\n\n");
-    printf("========================\n");
-    printf("Maze(%d x %d): (%d, %d)\n", maze->width, maze->height,
-      maze->wayX + 1, maze->wayY + 1);
-    printf("========================\n");
+int checkBounds(short x, short y)
+{
+  return checkBounds_Ctx(&defaultCtx, x, y);
+}
 
-    for (i = 0; i < maze->height; i++)
-    {
-      for (k = 0; k < maze->width; k++)
-      {
-#ifdef MAZEIII
-        writePixelBlock(k, i);
-#endif
-        if (maze->data[k][i] & GOAL)
-        {
-          textcolor(32);
-#ifdef MAZEIII
-          setBlockColor(k, i, 0, 255, 0);
-#endif
-        }
-        else if (isAlley(k, i))
-        {
-          textcolor(31);
-#ifdef MAZEIII
-          setBlockColor(k, i, 255, 0, 0);
-#endif
-        }
-        printf("%c", pipeList[maze->data[k][i] & BITSLICE_0x0F]);
-        textcolor(37);
-      }
-      printf("\n");
-    }
+maze_t *allocateMazeData(int width, int height)
+{
+  return allocateMazeData_Ctx(&defaultCtx, width, height);
+}
 
-#ifdef MAZEIII
-    FILE* f = fopen("maze.bmp", "wb");
-    fwrite(header, 1, sizeof(header), f);
-    fwrite(&mazeImg->image[0], 1,
-      sizeof(unsigned char) * mazeImg->pixelDataSize, f);
-    fclose(f);
-#endif
-  }
-  printf("\n");
+void mazeSolve()
+{
+  mazeSolve_Ctx(&defaultCtx);
+}
+
+void mazePrint()
+{
+  mazePrint_Ctx(&defaultCtx);
 }
 
-/*************************************************************/
-/*No inputs.                                                 */
-/*No return.                                                 */
-/*This function is called when the maze needs to be freed.   */
-/*Makes sure there is actually an active maze available. If  */
-/*  there is, it loops through each column and frees the     */
-/*  data. At the end, it frees the pointers to the old       */
-/*  columns.                                                 */
-/*************************************************************/
 void mazeFree()
 {
-  if (maze)
-  {
-    int i;
-    for (i = 0; i < maze->width; i++)
-    {
-      free(maze->data[i]);
-    }
-    free(maze->data);
-    free(maze);
-    maze = NULL;
-#ifdef MAZEIII
-    free(mazeImg->image);
-    free(mazeImg);
-    mazeImg = NULL;
-#endif
-  }
+  mazeFree_Ctx(&defaultCtx);
+}
+
+void mazeSeed(unsigned int seed)
+{
+  mazeCtxSeed(&defaultCtx, seed);
+}
+
+void mazeSetAlgorithm(int algorithm)
+{
+  mazeCtxSetAlgorithm(&defaultCtx, algorithm);
+}
+
+void mazeSetTrace(maze_trace_t *trace)
+{
+  mazeCtxSetTrace(&defaultCtx, trace);
+}
+
+maze_t *mazeAdopt(maze_gen_ctx_t *from)
+{
+  return mazeAdopt_Ctx(&defaultCtx, from);
+}
+
+int mazeStream(int width, int height, double joinProbability,
+  maze_row_func_t func, void *arg)
+{
+  return mazeStream_Ctx(&defaultCtx, width, height, joinProbability, func,
+    arg);
+}
+
+int mazeStreamToFile(const char *path, int width, int height,
+  double joinProbability)
+{
+  return mazeStreamToFile_Ctx(&defaultCtx, path, width, height,
+    joinProbability);
 }
 
 //===========================================================================
@@ -1,6 +1,8 @@
 #ifndef MAZEGEN_H
 #define MAZEGEN_H
 
+#include <stddef.h>
+
 #define BITSLICE_0x0F 0x0F
 
 #define TRUE 1
@@ -20,6 +22,15 @@
 #define VISITED 32          //0010 0000 (useful when solving maze)
 #define SPECIAL 64          //0100 0000
 
+#define MAZE_MAX_SIZE 16384
+#define MAZE_STREAM_MAX_SIZE 16777216 // streamed mazes only keep one row
+
+// generation algorithms (see mazeCtxSetAlgorithm)
+#define MAZE_ALGO_JOEL 0    // recursive backtracker, the default
+#define MAZE_ALGO_KRUSKAL 1 // union-find over a shuffled edge list
+#define MAZE_ALGO_TILED 2   // Kruskal tiles carved on every core, stitched
+#define MAZE_NUM_ALGOS 3
+
 #define TEXTCOLOR_BLACK   30
 #define TEXTCOLOR_RED     31
 #define TEXTCOLOR_GREEN   32
@@ -33,7 +44,10 @@ typedef unsigned char uint8;
 
 typedef struct
 {
-  uint8 **data;
+  uint8 *cells; // row-major, use MAZE_GET/MAZE_SET to get at a cell
+                // the cells one step outside the maze can also be read
+  int stride;   // bytes from one row to the next
+  char bPacked; // two cells per byte, walls only
   short width, height;
   short startX, startY;
   short endX, endY;
@@ -42,8 +56,88 @@ typedef struct
   double dirPercent;
   double straightProb;
   char printSteps;
+  unsigned int seed; // rebuilds this maze when given back to mazeSeed
 } maze_t;
 
+// The cell at column x, row y. Everything outside of the generator
+// should go through MAZE_GET/MAZE_SET, which work for both layouts.
+// MAZE_CELL is only valid for mazes that are not packed.
+#define MAZE_INDEX(maze, x, y) ((ptrdiff_t)(y) * (maze)->stride + (x))
+#define MAZE_CELL(maze, x, y) ((maze)->cells[MAZE_INDEX(maze, x, y)])
+
+// Packed mazes keep two cells per byte, even columns in the low nibble.
+#define MAZE_PACKED(maze, x, y) \
+  ((maze)->cells[(ptrdiff_t)(y) * (maze)->stride + ((x) >> 1)])
+#define MAZE_NIBBLE_SHIFT(x) (((x) & 1) << 2)
+
+#define MAZE_GET(maze, x, y) ((maze)->bPacked ? \
+  (MAZE_PACKED(maze, x, y) >> MAZE_NIBBLE_SHIFT(x) & BITSLICE_0x0F) : \
+  MAZE_CELL(maze, x, y))
+#define MAZE_SET(maze, x, y, value) ((maze)->bPacked ? \
+  (MAZE_PACKED(maze, x, y) = (uint8)((MAZE_PACKED(maze, x, y) & \
+    (0xF0 >> MAZE_NIBBLE_SHIFT(x))) | \
+    ((value) & BITSLICE_0x0F) << MAZE_NIBBLE_SHIFT(x))) : \
+  (MAZE_CELL(maze, x, y) = (uint8)(value)))
+
+// Holds all of the working state for one generation. Each thread that
+// generates mazes needs its own context (see mazeCtxCreate).
+typedef struct maze_gen_ctx_s maze_gen_ctx_t;
+
+// One maze's worth of mazeGenerate arguments, used by the batch API.
+typedef struct
+{
+  int width, height;
+  int wayPointX, wayPointY;
+  int wayPointAlleyLength;
+  double wayPointDirectionPercent;
+  double straightProbability;
+  unsigned int seed;
+  char bPacked; // see mazeCtxSetPacked
+  char algorithm; // MAZE_ALGO_*, see mazeCtxSetAlgorithm
+} maze_params_t;
+
+// A maze too big to carve up front, such as a giant challenge level.
+// Cells are carved a chunk at a time the first time they are looked at,
+// so the time and memory it takes follow how much has been explored.
+typedef struct
+{
+  int width, height;
+  int startX, startY;
+  int endX, endY;
+  unsigned int seed; // the whole maze follows from this
+  int numChunks;     // chunks carved so far
+  struct maze_chunks_s *chunks;
+} maze_lazy_t;
+
+// A recorded carve (see mazeCtxSetTrace). Each event is one unsigned int,
+// so recording a step costs the same whatever the size of the maze.
+typedef struct
+{
+  unsigned int *events; // in the order they happened, see MAZE_EVENT
+  size_t numEvents, capacity;
+  int width, height;
+  char bFailed;         // ran out of memory, the events stop short
+  maze_gen_ctx_t *player; // holds the maze as of position
+  size_t position;        // events played so far, see mazeTraceSeek
+} maze_trace_t;
+
+// An event is the cell (y * width + x) above four bits holding its kind
+// and the index into DIRECTION_LIST of the wall.
+#define MAZE_EVENT_OPEN 0  // the wall was opened
+#define MAZE_EVENT_CLOSE 1 // the wall was closed again
+#define MAZE_EVENT_MARK 2  // a stage of the carve ended, no cell
+#define MAZE_EVENT(cell, kind, direction) \
+  ((unsigned int)(cell) << 4 | (kind) << 2 | (direction))
+#define MAZE_EVENT_CELL(event) ((event) >> 4)
+#define MAZE_EVENT_KIND(event) ((event) >> 2 & 3)
+#define MAZE_EVENT_DIRECTION(event) ((event) & 3)
+
+// Receives each row of a streamed maze in order, one byte per cell
+// holding its openings. The row is only valid during the call. Return
+// FALSE to stop the maze early.
+typedef int(*maze_row_func_t)(const uint8 *row, int width, int y,
+  void *arg);
+
 extern void textcolor(int color);
 
 //=======================================================================
@@ -59,7 +153,7 @@ extern const unsigned char pipeList[];
 //=======================================================================
 //Returns TRUE if one or more parameters are out of range. 
 //  Otherwise, returns FALSE. 
-maze_t *mazeGenerate(int width, int height, // [3, 1000],  [3, 1000]
+maze_t *mazeGenerate(int width, int height, // [3, MAZE_MAX_SIZE] each
   int wayPointX, int wayPointY,       // [1, width],   [1, height]
   int wayPointAlleyLength,            // [0,  min(width, height)/2 ]
   double wayPointDirectionPercent,    // [0.0,  1.0]
@@ -78,4 +172,105 @@ void mazeSolve();
 void mazePrint();
 
 void mazeFree();
+
+void mazeSeed(unsigned int seed); // seed for the next mazeGenerate call
+
+void mazeSetAlgorithm(int algorithm); // MAZE_ALGO_* for mazeGenerate
+
+void mazeSetTrace(maze_trace_t *trace); // records mazeGenerate, or NULL
+
+int mazeFindAlgorithm(const char *name); // MAZE_ALGO_* or -1
+
+// takes over the maze another context generated, see mazeAdopt_Ctx
+maze_t *mazeAdopt(maze_gen_ctx_t *from);
+
+//=======================================================================
+//Reentrant versions of the functions above. The context free versions
+//  all share a single context, so they must only be used from one
+//  thread at a time. A maze returned by a context belongs to it and is
+//  freed by mazeFree_Ctx or mazeCtxDestroy.
+maze_gen_ctx_t *mazeCtxCreate();
+void mazeCtxDestroy(maze_gen_ctx_t *ctx);
+
+maze_t *mazeGenerate_Ctx(maze_gen_ctx_t *ctx,
+  int width, int height,
+  int wayPointX, int wayPointY,
+  int wayPointAlleyLength,
+  double wayPointDirectionPercent,
+  double straightProbability,
+  int printAlgorithmSteps);
+
+int checkBounds_Ctx(maze_gen_ctx_t *ctx, short x, short y);
+
+maze_t *allocateMazeData_Ctx(maze_gen_ctx_t *ctx, int width, int height);
+
+void mazeSolve_Ctx(maze_gen_ctx_t *ctx);
+// Solves a maze without writing to it, so threads that each have their
+// own context can solve the same maze at once. The path stays in the
+// context for mazeCtxOnPath. FALSE if there is none or out of memory.
+int mazeSolveShared_Ctx(maze_gen_ctx_t *ctx, const maze_t *maze);
+int mazeCtxOnPath(maze_gen_ctx_t *ctx, int x, int y); // on that path
+
+void mazePrint_Ctx(maze_gen_ctx_t *ctx);
+
+void mazeFree_Ctx(maze_gen_ctx_t *ctx);
+
+void mazeCtxSeed(maze_gen_ctx_t *ctx, unsigned int seed);
+void mazeCtxSetPacked(maze_gen_ctx_t *ctx, int bPacked);
+void mazeCtxSetAlgorithm(maze_gen_ctx_t *ctx, int algorithm);
+void mazeCtxSetThreads(maze_gen_ctx_t *ctx, int numThreads); // 0 = all
+void mazeCtxSetQuiet(maze_gen_ctx_t *ctx, int bQuiet);
+maze_t *mazeAdopt_Ctx(maze_gen_ctx_t *ctx, maze_gen_ctx_t *from);
+maze_t *mazeCtxDetach(maze_gen_ctx_t *ctx); // caller frees with mazeRelease
+void mazeRelease(maze_t *maze);
+maze_t *mazeCopy(const maze_t *maze); // caller frees with mazeRelease
+// cells with one opening that leads to another cell, so the start and
+// exit openings do not count, the same as ms_Analyze. -1 if out of memory
+long long mazeCountDeadEnds(const maze_t *maze);
+
+//=======================================================================
+//Generates count mazes on numThreads threads (0 = one per core) and
+//  returns how many were built. Every maze comes from its own seed, so
+//  the output is the same for any number of threads.
+int mazeGenerateBatch(const maze_params_t *params, int count,
+  maze_t **mazes, int numThreads);
+int mazeGenerateSeedRange(const maze_params_t *params,
+  unsigned int firstSeed, int count, maze_t **mazes, int numThreads);
+
+//=======================================================================
+//Streams a perfect maze row by row (Eller's Algorithm) without ever
+//  holding more than one row, so the size is only limited by
+//  MAZE_STREAM_MAX_SIZE. Both return TRUE if every row was produced.
+//  The file holds the rows packed two cells per byte, with no header.
+int mazeStream(int width, int height,   // [3, MAZE_STREAM_MAX_SIZE] each
+  double joinProbability,               // [0.0,  1.0]
+  maze_row_func_t func, void *arg);
+int mazeStreamToFile(const char *path, int width, int height,
+  double joinProbability);
+int mazeStream_Ctx(maze_gen_ctx_t *ctx, int width, int height,
+  double joinProbability, maze_row_func_t func, void *arg);
+int mazeStreamToFile_Ctx(maze_gen_ctx_t *ctx, const char *path,
+  int width, int height, double joinProbability);
+
+//=======================================================================
+//Lazy mazes (see maze_lazy_t) are perfect, and come out the same from
+//  the same seed whatever order they are explored in.
+maze_lazy_t *mazeLazyCreate(int width, // [3, MAZE_STREAM_MAX_SIZE] each
+  int height, unsigned int seed);      // NULL if out of memory
+void mazeLazyFree(maze_lazy_t *lazy);
+uint8 mazeLazyGet(maze_lazy_t *lazy, int x, int y); // openings, carves
+int mazeLazyReveal(maze_lazy_t *lazy, int left, int top, // carves ahead,
+  int right, int bottom);                                // inclusive
+
+//=======================================================================
+//Carve traces (see maze_trace_t). With printAlgorithmSteps set a maze
+//  is recorded and then replayed a frame per stage, instead of being
+//  drawn in full at every stage while it is carved.
+maze_trace_t *mazeTraceCreate();
+void mazeTraceFree(maze_trace_t *trace);
+void mazeCtxSetTrace(maze_gen_ctx_t *ctx, maze_trace_t *trace); // or NULL
+maze_t *mazeTraceSeek(maze_trace_t *trace, size_t position); // scrubs
+size_t mazeTraceNextMark(const maze_trace_t *trace, size_t position);
+int mazeTraceReplay(maze_trace_t *trace, // prints every frame
+  size_t eventsPerFrame);                // 0 = one per MAZE_EVENT_MARK
 #endif
@@ -0,0 +1,228 @@
+#include "mazepool.h"
+#include "threads.h"
+#include <string.h>
+
+typedef struct
+{
+  maze_params_t params;
+  // every slot owns a context, the ready ones start at head
+  maze_gen_ctx_t *slots[MP_DEPTH];
+  int head, count;
+  char bFailed; // generation ran out of memory, mp_Take makes its own
+} mp_preset_t;
+
+typedef struct
+{
+  mp_preset_t presets[MP_MAX_PRESETS];
+  int numPresets;
+  int epoch; // bumped whenever the presets change
+  char bRunning;
+  mutex_t *lock;
+  cond_t *ready; // a maze was added or generation failed
+  cond_t *space; // a maze was taken, or the pool changed
+  thread_t *thread;
+} mazePool_t;
+
+static mazePool_t pool;
+
+// generates on the calling thread with the shared context
+static maze_t *mp_Generate(const maze_params_t *params)
+{
+  return mazeGenerate(params->width, params->height, params->wayPointX,
+    params->wayPointY, params->wayPointAlleyLength,
+    params->wayPointDirectionPercent, params->straightProbability, FALSE);
+}
+
+// frees everything but the presets, so mp_Take can still fall back on them
+static void mp_Free(void)
+{
+  int i, k;
+
+  for (i = 0; i < pool.numPresets; i++)
+  {
+    for (k = 0; k < MP_DEPTH; k++)
+    {
+      mazeCtxDestroy(pool.presets[i].slots[k]);
+      pool.presets[i].slots[k] = NULL;
+    }
+    pool.presets[i].head = 0;
+    pool.presets[i].count = 0;
+  }
+
+  th_CondDestroy(pool.ready);
+  th_CondDestroy(pool.space);
+  th_MutexDestroy(pool.lock);
+  pool.ready = NULL;
+  pool.space = NULL;
+  pool.lock = NULL;
+  pool.bRunning = FALSE;
+}
+
+// Keeps filling the emptiest preset. The slot being filled is past the
+// ready ones, so nothing else touches it while the lock is let go.
+static void mp_Producer(void *arg)
+{
+  mp_preset_t *preset;
+  maze_gen_ctx_t *ctx;
+  maze_params_t params;
+  int i, epoch;
+  char bMade;
+
+  (void)arg; // the pool is global
+
+  th_Lock(pool.lock);
+  while (pool.bRunning)
+  {
+    preset = NULL;
+    for (i = 0; i < pool.numPresets; i++)
+    {
+      if (pool.presets[i].count < MP_DEPTH && !pool.presets[i].bFailed &&
+        (!preset || pool.presets[i].count < preset->count))
+      {
+        preset = &pool.presets[i];
+      }
+    }
+    if (!preset)
+    {
+      th_CondWait(pool.space, pool.lock);
+      continue;
+    }
+
+    ctx = preset->slots[(preset->head + preset->count) % MP_DEPTH];
+    params = preset->params;
+    epoch = pool.epoch;
+    th_Unlock(pool.lock);
+
+    mazeCtxSetAlgorithm(ctx, params.algorithm);
+    mazeCtxSetPacked(ctx, params.bPacked);
+    bMade = mazeGenerate_Ctx(ctx, params.width, params.height,
+      params.wayPointX, params.wayPointY, params.wayPointAlleyLength,
+      params.wayPointDirectionPercent, params.straightProbability,
+      FALSE) != NULL;
+
+    th_Lock(pool.lock);
+    if (epoch != pool.epoch) continue; // made with the old settings
+    if (bMade) preset->count++;
+    else preset->bFailed = TRUE;
+    th_CondBroadcast(pool.ready);
+  }
+  th_Unlock(pool.lock);
+}
+
+int mp_Init(const maze_params_t *presets, int numPresets)
+{
+  maze_gen_ctx_t *ctx;
+  int i, k;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.numPresets = numPresets < MP_MAX_PRESETS ? numPresets : MP_MAX_PRESETS;
+  for (i = 0; i < pool.numPresets; i++)
+  {
+    pool.presets[i].params = presets[i];
+    for (k = 0; k < MP_DEPTH; k++)
+    {
+      ctx = mazeCtxCreate();
+      pool.presets[i].slots[k] = ctx;
+      if (!ctx)
+      {
+        mp_Free();
+        return FALSE;
+      }
+      mazeCtxSetQuiet(ctx, TRUE);
+      mazeCtxSetThreads(ctx, 1); // stays out of the game's way
+    }
+  }
+
+  pool.lock = th_MutexCreate();
+  pool.ready = th_CondCreate();
+  pool.space = th_CondCreate();
+  pool.bRunning = TRUE;
+  if (pool.lock && pool.ready && pool.space)
+  {
+    pool.thread = th_Create(mp_Producer, NULL);
+  }
+  if (!pool.thread)
+  {
+    mp_Free();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void mp_Shutdown(void)
+{
+  if (pool.thread)
+  {
+    th_Lock(pool.lock);
+    pool.bRunning = FALSE;
+    th_CondBroadcast(pool.space);
+    th_Unlock(pool.lock);
+
+    th_Join(pool.thread); // waits out any maze still being made
+    pool.thread = NULL;
+  }
+  mp_Free();
+}
+
+maze_t *mp_Take(int preset)
+{
+  mp_preset_t *p = &pool.presets[preset];
+  maze_t *maze;
+
+  if (!pool.bRunning) return mp_Generate(&p->params);
+
+  th_Lock(pool.lock);
+  while (!p->count && !p->bFailed)
+  {
+    th_CondWait(pool.ready, pool.lock);
+  }
+
+  // try it here, where the error gets printed, and let the pool retry
+  if (!p->count)
+  {
+    p->bFailed = FALSE;
+    th_CondBroadcast(pool.space);
+    th_Unlock(pool.lock);
+    return mp_Generate(&p->params);
+  }
+
+  maze = mazeAdopt(p->slots[p->head]);
+  p->head = (p->head + 1) % MP_DEPTH;
+  p->count--;
+  th_CondBroadcast(pool.space);
+  th_Unlock(pool.lock);
+
+  return maze;
+}
+
+void mp_SetAlgorithm(int algorithm)
+{
+  int i, k;
+  mp_preset_t *p;
+
+  if (!pool.bRunning)
+  {
+    for (i = 0; i < pool.numPresets; i++)
+    {
+      pool.presets[i].params.algorithm = (char)algorithm;
+    }
+    return;
+  }
+
+  th_Lock(pool.lock);
+  for (i = 0; i < pool.numPresets; i++)
+  {
+    p = &pool.presets[i];
+    p->params.algorithm = (char)algorithm;
+    for (k = 0; k < p->count; k++)
+    {
+      mazeFree_Ctx(p->slots[(p->head + k) % MP_DEPTH]);
+    }
+    p->count = 0;
+    p->bFailed = FALSE;
+  }
+  pool.epoch++;
+  th_CondBroadcast(pool.space);
+  th_Unlock(pool.lock);
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#ifndef MP_MAZEPOOL_H
+#define MP_MAZEPOOL_H
+
+#include "mazegen.h"
+
+#define MP_MAX_PRESETS 4
+#define MP_DEPTH 2 // finished mazes kept ready for each preset
+
+// Starts a thread that keeps MP_DEPTH mazes ready for each preset, so
+// starting a game never waits on the generator. The seeds of the presets
+// are ignored, every maze gets its own. Returns FALSE if the thread could
+// not be started, in which case mp_Take generates on the spot.
+int mp_Init(const maze_params_t *presets, int numPresets);
+void mp_Shutdown(void);
+
+// Hands a maze made from the preset to the shared context, freeing its
+// old one, and returns it just like mazeGenerate would. Only waits if
+// the pool has not caught up yet.
+maze_t *mp_Take(int preset);
+
+// Switches every preset to a new MAZE_ALGO_* and throws away the mazes
+// that were made with the old one.
+void mp_SetAlgorithm(int algorithm);
+
+#endif // MP_MAZEPOOL_H
\ No newline at end of file
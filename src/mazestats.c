@@ -0,0 +1,210 @@
+#include "mazestats.h"
+#include "bitplane.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The analyzer works on a copy of the walls, one byte per cell. The low
+// nibble holds the openings that lead to another cell. While corridors
+// are counted the high nibble marks the ways out of a cell that have been
+// walked already, and while solving it holds the way back (MS_BACK).
+#define MS_DONE_SHIFT 4
+#define MS_BACK(cell) ((cell) >> 4)
+#define MS_ROOT 5 // the way back from the start, which has none
+#define MS_STOP 4 // see ms_WayOn
+
+static const int ms_Opposite[] = { 2, 3, 0, 1 };
+
+// number of openings in each combination of walls
+static const char ms_Degree[] =
+{
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+// The way on after stepping into a cell going the given way (as an index
+// into DIRECTION_LIST), or MS_STOP if the cell does not have two openings
+// and so ends the corridor.
+static const char ms_WayOn[16][TOTAL_DIRECTIONS] =
+{
+  { 4, 4, 4, 4 }, { 4, 4, 4, 4 }, { 4, 4, 4, 4 }, { 4, 4, 1, 0 },
+  { 4, 4, 4, 4 }, { 0, 4, 2, 4 }, { 1, 4, 4, 2 }, { 4, 4, 4, 4 },
+  { 4, 4, 4, 4 }, { 4, 0, 3, 4 }, { 4, 1, 4, 3 }, { 4, 4, 4, 4 },
+  { 3, 2, 4, 4 }, { 4, 4, 4, 4 }, { 4, 4, 4, 4 }, { 4, 4, 4, 4 },
+};
+
+// copies the openings that lead to another cell, so the start and exit
+// do not count as a way out
+static void ms_LoadCells(const maze_t *maze, uint8 *cells)
+{
+  int x, y;
+  uint8 *row;
+
+  for (y = 0; y < maze->height; y++)
+  {
+    row = cells + (size_t)y * maze->width;
+    for (x = 0; x < maze->width; x++)
+    {
+      row[x] = MAZE_GET(maze, x, y) & BITSLICE_0x0F;
+    }
+    row[0] &= ~WEST;
+    row[maze->width - 1] &= ~EAST;
+  }
+  for (x = 0; x < maze->width; x++)
+  {
+    cells[x] &= ~NORTH;
+    cells[(size_t)(maze->height - 1) * maze->width + x] &= ~SOUTH;
+  }
+}
+
+// Depth first from the start to the exit, stepping back along the way
+// each cell was entered instead of keeping a stack. Returns the number of
+// cells on the path, or -1 if there is none.
+static long long ms_SolutionLength(const maze_t *maze, uint8 *cells,
+  const ptrdiff_t *step)
+{
+  size_t cell = (size_t)maze->startY * maze->width + maze->startX;
+  size_t end = (size_t)maze->endY * maze->width + maze->endX;
+  long long depth = 0;
+  int d = 0;
+
+  cells[cell] |= MS_ROOT << MS_DONE_SHIFT;
+  while (cell != end)
+  {
+    for (; d < TOTAL_DIRECTIONS; d++)
+    {
+      if ((cells[cell] & DIRECTION_LIST[d]) &&
+        !MS_BACK(cells[cell + step[d]])) break;
+    }
+
+    if (d < TOTAL_DIRECTIONS)
+    {
+      cell += step[d];
+      cells[cell] |= (ms_Opposite[d] + 1) << MS_DONE_SHIFT;
+      d = 0;
+      depth++;
+    }
+    else if (MS_BACK(cells[cell]) == MS_ROOT) return -1;
+    else
+    {
+      // carry on with the parent's next direction
+      d = MS_BACK(cells[cell]) - 1;
+      cell += step[d];
+      d = ms_Opposite[d] + 1;
+      depth--;
+    }
+  }
+
+  return depth + 1;
+}
+
+// Everything but the solution comes from one pass over the cells. Each
+// corridor is walked once, from whichever end comes first in row order,
+// and its far end is marked so it is not walked again from there.
+int ms_Analyze(const maze_t *maze, ms_stats_t *stats)
+{
+  size_t numCells = (size_t)maze->width * maze->height, i, j;
+  uint8 *cells = (uint8*)malloc(numCells);
+  long long ways = 0, waysFrom = 0, riverSteps = 0, corridorSteps = 0;
+  ptrdiff_t step[TOTAL_DIRECTIONS];
+  int d, way, next, steps, bucket, degree;
+  uint8 bits;
+
+  memset(stats, 0, sizeof(ms_stats_t));
+  stats->numCells = (long long)numCells;
+  stats->solutionLength = -1;
+  if (!cells) return FALSE;
+
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    step[d] = DIRECTION_DX[d] + (ptrdiff_t)DIRECTION_DY[d] * maze->width;
+  }
+  ms_LoadCells(maze, cells);
+
+  for (i = 0; i < numCells; i++)
+  {
+    bits = cells[i] & BITSLICE_0x0F;
+    degree = ms_Degree[bits];
+    stats->degrees[degree]++;
+    if (degree >= 2)
+    {
+      ways += degree - 1;
+      waysFrom++;
+    }
+    if (degree == 2)
+    {
+      if (bits == (NORTH | SOUTH) || bits == (EAST | WEST))
+      {
+        stats->straights++;
+      }
+      else stats->turns++;
+      continue;
+    }
+
+    for (d = 0; d < TOTAL_DIRECTIONS; d++)
+    {
+      if (!(bits & DIRECTION_LIST[d]) ||
+        (cells[i] >> MS_DONE_SHIFT & DIRECTION_LIST[d])) continue;
+
+      j = i + step[d];
+      way = d;
+      steps = 1;
+      while ((next = ms_WayOn[cells[j] & BITSLICE_0x0F][way]) != MS_STOP)
+      {
+        way = next;
+        j += step[way];
+        steps++;
+      }
+      cells[j] |= DIRECTION_LIST[ms_Opposite[way]] << MS_DONE_SHIFT;
+
+      if (degree == 1) riverSteps += steps;
+      if (ms_Degree[cells[j] & BITSLICE_0x0F] == 1) riverSteps += steps;
+      for (bucket = 0; bucket < MS_LENGTH_BUCKETS - 1 &&
+        steps >> (bucket + 1); bucket++);
+      stats->corridors[bucket]++;
+      stats->numCorridors++;
+      corridorSteps += steps;
+      if (steps > stats->longestCorridor) stats->longestCorridor = steps;
+    }
+  }
+
+  stats->deadEnds = stats->degrees[1];
+  stats->junctions = stats->degrees[3] + stats->degrees[4];
+  if (stats->numCorridors)
+  {
+    stats->meanCorridor = (double)corridorSteps / stats->numCorridors;
+  }
+  if (stats->deadEnds)
+  {
+    stats->riverFactor = (double)riverSteps / stats->deadEnds;
+  }
+  if (waysFrom) stats->branchingFactor = (double)ways / waysFrom;
+
+  bp_MaskBytes(cells, numCells, BITSLICE_0x0F);
+  stats->solutionLength = ms_SolutionLength(maze, cells, step);
+  free(cells);
+
+  return stats->solutionLength >= 0;
+}
+
+void ms_Print(const ms_stats_t *stats)
+{
+  int i;
+
+  printf("Cells: %lld\n", stats->numCells);
+  printf("Dead ends: %lld (%.1f%%)\n", stats->deadEnds,
+    stats->numCells ? 100.0 * stats->deadEnds / stats->numCells : 0.0);
+  printf("Straights: %lld, turns: %lld\n", stats->straights, stats->turns);
+  printf("Junctions: %lld three way, %lld four way\n", stats->degrees[3],
+    stats->degrees[4]);
+  printf("Corridors: %lld, mean %.2f, longest %d\n", stats->numCorridors,
+    stats->meanCorridor, stats->longestCorridor);
+  for (i = 0; i < MS_LENGTH_BUCKETS; i++)
+  {
+    if (!stats->corridors[i]) continue;
+    printf("  %6d+ steps: %lld\n", 1 << i, stats->corridors[i]);
+  }
+  printf("River factor: %.2f\n", stats->riverFactor);
+  printf("Branching factor: %.3f\n", stats->branchingFactor);
+  if (stats->solutionLength < 0) printf("Solution: unknown\n");
+  else printf("Solution: %lld cells\n", stats->solutionLength);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#ifndef MS_MAZESTATS_H
+#define MS_MAZESTATS_H
+
+#include "mazegen.h"
+
+#define MS_LENGTH_BUCKETS 16 // corridor lengths 1, 2-3, 4-7, ... 32768+
+
+// Numbers for tuning the generator's parameters, see ms_Analyze. A cell's
+// openings only count when they lead to another cell, so the start and
+// exit are not junctions. A corridor is the passage between two cells
+// that are not straights or turns, measured in steps.
+typedef struct
+{
+  long long numCells;
+  long long degrees[TOTAL_DIRECTIONS + 1]; // cells by number of openings
+  long long deadEnds;   // cells with one opening, as mazeCountDeadEnds
+  long long junctions;  // cells with three or four
+  long long straights;  // cells with two openings facing each other
+  long long turns;      // cells with two openings at a right angle
+  long long corridors[MS_LENGTH_BUCKETS]; // by length, see above
+  long long numCorridors;
+  int longestCorridor;
+  double meanCorridor;
+  double riverFactor;     // mean length of a dead end's corridor
+  double branchingFactor; // mean ways on from cells that are not dead ends
+  long long solutionLength; // cells from start to exit, -1 if unknown
+} ms_stats_t;
+
+// Fills in stats in linear time, for packed mazes too, using a byte per
+// cell of scratch memory. Returns FALSE if that could not be allocated or
+// the exit can not be reached, which leaves solutionLength at -1.
+int ms_Analyze(const maze_t *maze, ms_stats_t *stats);
+void ms_Print(const ms_stats_t *stats);
+
+#endif // MS_MAZESTATS_H
\ No newline at end of file
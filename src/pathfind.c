@@ -0,0 +1,1647 @@
+#include "pathfind.h"
+#include "threads.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Heap entries keep the length of the path through a cell or node above
+// it, estimated by A* and exact for the junction graph.
+#define PF_HEAP_KEY(estimate, cell) \
+  ((unsigned long long)(estimate) << 32 | (cell))
+#define PF_HEAP_CELL(key) ((unsigned int)(key))
+#define PF_HEAP_ESTIMATE(key) ((unsigned int)((key) >> 32))
+#define PF_MIN_NODES 1024
+#define PF_HINT_SHIFT(cell) (((cell) & 3) << 1) // bits below a cell's way
+
+#define PF_PARALLEL_CELLS 65536 // smaller mazes are always flooded serially
+#define PF_PARALLEL_LEVEL 1024  // narrower levels are expanded by one thread
+#define PF_MIN_FRONTIER 1024
+#define PF_SEEN_BIT(cell) (1U << ((cell) & 31))
+#define PF_SEEN(seen, cell) ((seen)[(cell) >> 5] & PF_SEEN_BIT(cell))
+
+// A cell claimed by a parent, with the index into DIRECTION_LIST of the
+// way from the parent to it. Cells fit in 30 bits, see MAZE_MAX_SIZE.
+#define PF_FOUND(parent, cell, way) \
+  ((unsigned long long)(parent) << 32 | (cell) << 2 | (way))
+#define PF_FOUND_PARENT(found) ((unsigned int)((found) >> 32))
+#define PF_FOUND_CELL(found) ((unsigned int)(found) >> 2)
+#define PF_FOUND_WAY(found) ((int)(found) & 3)
+
+static const int pf_Opposite[] = { 2, 3, 0, 1 };
+
+// One level of pf_FloodParallel. The frontier is the cells every thread
+// queued on the level before, taken in thread order, or the end of the
+// field's queue if thread 0 found them alone.
+typedef struct
+{
+  int cur;           // which of the threads' lists hold the frontier
+  char bQueued;      // the frontier is only in the field's queue
+  size_t start;      // queue position of the frontier's first cell
+  size_t size;       // cells in the frontier
+  unsigned int dist; // steps from the source to each of them
+} pf_level_t;
+
+// the cells a thread queued on this level and the one before
+typedef struct
+{
+  unsigned int *list[2];
+  size_t count[2], size[2];
+  unsigned long long *found; // cells it claimed, see pf_FloodClaim
+  size_t numFound, foundSize;
+} pf_frontier_t;
+
+typedef struct
+{
+  pf_field_t *field;
+  const maze_t *maze;
+  ptrdiff_t step[TOTAL_DIRECTIONS];
+  volatile unsigned int *seen;  // bitset of the cells with a distance
+  volatile unsigned int *claim; // queue position + 1 of a cell's parent
+  pf_frontier_t *frontiers;     // one per thread
+  int numThreads;
+  mutex_t *gate;                // held while the threads are started
+  barrier_t *barrier;
+  volatile int nextThread;
+  volatile int numFailed;       // frontiers that could not grow
+  pf_level_t level;             // handed on by thread 0, see pf_FloodLevels
+  char bDone;
+} pf_flood_t;
+
+// number of openings in each combination of walls
+static const char pf_Degree[] =
+{
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+};
+
+// the index into DIRECTION_LIST of a single opening, -1 for any other
+static const char pf_WayOf[] =
+{
+  -1, 0, 1, -1, 2, -1, -1, -1, 3, -1, -1, -1, -1, -1, -1, -1
+};
+
+// the openings of a cell that lead to another cell, so the flood never
+// steps out through the start or the exit
+static int pf_Openings(const maze_t *maze, int x, int y)
+{
+  int bits = MAZE_GET(maze, x, y) & BITSLICE_0x0F;
+
+  if (!x) bits &= ~WEST;
+  if (x == maze->width - 1) bits &= ~EAST;
+  if (!y) bits &= ~NORTH;
+  if (y == maze->height - 1) bits &= ~SOUTH;
+
+  return bits;
+}
+
+// the offset from a cell to its neighbour the given way
+static ptrdiff_t pf_Step(int width, int d)
+{
+  return DIRECTION_DX[d] + (ptrdiff_t)DIRECTION_DY[d] * width;
+}
+
+// grows the buffers to hold numCells, keeping them if they already do
+static int pf_Reserve(pf_field_t *field, size_t numCells)
+{
+  if (numCells <= field->capacity) return TRUE;
+
+  free(field->dist);
+  free(field->back);
+  free(field->queue);
+  field->dist = (unsigned int*)malloc(numCells * sizeof(unsigned int));
+  field->back = (uint8*)malloc(numCells);
+  field->queue = (unsigned int*)malloc(numCells * sizeof(unsigned int));
+  if (!field->dist || !field->back || !field->queue)
+  {
+    free(field->dist);
+    free(field->back);
+    free(field->queue);
+    field->dist = NULL;
+    field->back = NULL;
+    field->queue = NULL;
+    field->capacity = 0;
+    return FALSE;
+  }
+  field->capacity = numCells;
+
+  return TRUE;
+}
+
+pf_field_t *pf_Create(void)
+{
+  return (pf_field_t*)calloc(1, sizeof(pf_field_t));
+}
+
+void pf_Free(pf_field_t *field)
+{
+  if (!field) return;
+
+  free(field->dist);
+  free(field->back);
+  free(field->queue);
+  free(field);
+}
+
+// The queue doubles as the record of the order cells were reached in, so
+// the flood needs no memory beyond the field itself.
+int pf_Flood(pf_field_t *field, const maze_t *maze, int x, int y)
+{
+  size_t numCells = (size_t)maze->width * maze->height;
+  size_t head = 0, tail = 1;
+  unsigned int cell, next, *dist;
+  ptrdiff_t step[TOTAL_DIRECTIONS];
+  int d, cx, cy, bits;
+
+  field->numReached = 0;
+  if (!pf_Reserve(field, numCells)) return FALSE;
+  field->width = maze->width;
+  field->height = maze->height;
+  field->sourceX = x;
+  field->sourceY = y;
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    step[d] = pf_Step(maze->width, d);
+  }
+
+  dist = field->dist;
+  memset(dist, 0xFF, numCells * sizeof(unsigned int));
+  cell = (unsigned int)y * maze->width + x;
+  dist[cell] = 0;
+  field->back[cell] = PF_SOURCE;
+  field->queue[0] = cell;
+
+  while (head < tail)
+  {
+    cell = field->queue[head++];
+    cy = cell / maze->width;
+    cx = cell - cy * maze->width;
+    bits = pf_Openings(maze, cx, cy);
+
+    for (d = 0; d < TOTAL_DIRECTIONS; d++)
+    {
+      if (!(bits & DIRECTION_LIST[d])) continue;
+
+      next = (unsigned int)(cell + step[d]);
+      if (dist[next] != PF_UNREACHED) continue;
+      dist[next] = dist[cell] + 1;
+      field->back[next] = (uint8)pf_Opposite[d];
+      field->queue[tail++] = next;
+    }
+  }
+  field->numReached = tail;
+
+  return TRUE;
+}
+
+long long pf_Distance(const pf_field_t *field, int x, int y)
+{
+  unsigned int dist;
+
+  if (x < 0 || y < 0 || x >= field->width || y >= field->height ||
+    !field->numReached) return -1;
+
+  dist = field->dist[(size_t)y * field->width + x];
+  return dist == PF_UNREACHED ? -1 : (long long)dist;
+}
+
+int pf_WayBack(const pf_field_t *field, int x, int y)
+{
+  if (pf_Distance(field, x, y) <= 0) return -1;
+
+  return field->back[(size_t)y * field->width + x];
+}
+
+// walks the ways back from x, y, filling the path in from its end
+long long pf_Path(const pf_field_t *field, int x, int y, unsigned int *path)
+{
+  long long length = pf_Distance(field, x, y), i;
+  size_t cell = (size_t)y * field->width + x;
+
+  for (i = length; i >= 0; i--)
+  {
+    path[i] = (unsigned int)cell;
+    if (i) cell += pf_Step(field->width, field->back[cell]);
+  }
+
+  return length + 1;
+}
+
+pf_hints_t *pf_HintsCreate(void)
+{
+  return (pf_hints_t*)calloc(1, sizeof(pf_hints_t));
+}
+
+void pf_HintsFree(pf_hints_t *hints)
+{
+  if (!hints) return;
+
+  free(hints->ways);
+  free(hints);
+}
+
+// Each byte is put together from its four cells and written once.
+int pf_HintsBuild(pf_hints_t *hints, const pf_field_t *field)
+{
+  size_t numCells = (size_t)field->width * field->height;
+  size_t bytes = (numCells + 3) / 4, cell;
+  unsigned int dist;
+  uint8 *ways, packed = 0;
+
+  hints->width = 0;
+  hints->height = 0;
+  if (!field->numReached) return FALSE;
+  if (bytes > hints->capacity)
+  {
+    ways = (uint8*)malloc(bytes);
+    if (!ways) return FALSE;
+    free(hints->ways);
+    hints->ways = ways;
+    hints->capacity = bytes;
+  }
+
+  for (cell = 0; cell < numCells; cell++)
+  {
+    dist = field->dist[cell];
+    if (dist && dist != PF_UNREACHED)
+    {
+      packed |= (uint8)(field->back[cell] << PF_HINT_SHIFT(cell));
+    }
+    if ((cell & 3) == 3 || cell == numCells - 1)
+    {
+      hints->ways[cell >> 2] = packed;
+      packed = 0;
+    }
+  }
+
+  hints->width = field->width;
+  hints->height = field->height;
+  hints->goalX = field->sourceX;
+  hints->goalY = field->sourceY;
+
+  return TRUE;
+}
+
+int pf_HintWay(const pf_hints_t *hints, int x, int y)
+{
+  size_t cell = (size_t)y * hints->width + x;
+
+  if (x < 0 || y < 0 || x >= hints->width || y >= hints->height ||
+    (x == hints->goalX && y == hints->goalY)) return -1;
+
+  return hints->ways[cell >> 2] >> PF_HINT_SHIFT(cell) & 3;
+}
+
+// Grows the buffers to hold numCells. The stamps start out at 0, which no
+// query uses, so the new cells have never been seen.
+static int pf_SearchReserve(pf_search_t *search, size_t numCells)
+{
+  if (numCells <= search->capacity) return TRUE;
+
+  free(search->stamp);
+  free(search->dist);
+  free(search->back);
+  free(search->open);
+  search->stamp = (unsigned int*)calloc(numCells, sizeof(unsigned int));
+  search->dist = (unsigned int*)malloc(numCells * sizeof(unsigned int));
+  search->back = (uint8*)malloc(numCells);
+  search->open = (unsigned long long*)malloc(numCells *
+    sizeof(unsigned long long));
+  search->query = 0;
+  if (!search->stamp || !search->dist || !search->back || !search->open)
+  {
+    free(search->stamp);
+    free(search->dist);
+    free(search->back);
+    free(search->open);
+    search->stamp = NULL;
+    search->dist = NULL;
+    search->back = NULL;
+    search->open = NULL;
+    search->capacity = 0;
+    search->openSize = 0;
+    return FALSE;
+  }
+  search->capacity = numCells;
+  search->openSize = numCells;
+
+  return TRUE;
+}
+
+// Each query takes two stamps, one for each side of the search. They are
+// only cleared when they run out.
+static void pf_NextQuery(pf_search_t *search)
+{
+  if (search->query >= UINT_MAX - 3)
+  {
+    memset(search->stamp, 0, search->capacity * sizeof(unsigned int));
+    search->query = 0;
+  }
+  search->query += 2;
+}
+
+static void pf_See(pf_search_t *search, unsigned int cell,
+  unsigned int stamp, unsigned int dist, int back)
+{
+  search->stamp[cell] = stamp;
+  search->dist[cell] = dist;
+  search->back[cell] = (uint8)back;
+}
+
+// the Manhattan distance, which never overestimates the steps in a maze
+static unsigned int pf_Estimate(int x, int y, int toX, int toY)
+{
+  return (unsigned int)(abs(x - toX) + abs(y - toY));
+}
+
+// Adds key to a heap holding count of size entries, which grows if it is
+// full. That only happens for mazes with loops, where a cell can be opened
+// again after a shorter way to it turns up.
+static int pf_HeapPush(unsigned long long **open, size_t *size,
+  size_t *count, unsigned long long key)
+{
+  unsigned long long *heap = *open, *grown;
+  size_t i = *count, parent;
+
+  if (i == *size)
+  {
+    grown = (unsigned long long*)realloc(heap,
+      *size * 2 * sizeof(unsigned long long));
+    if (!grown) return FALSE;
+    heap = *open = grown;
+    *size *= 2;
+  }
+  (*count)++;
+
+  for (; i; i = parent)
+  {
+    parent = (i - 1) / 2;
+    if (heap[parent] <= key) break;
+    heap[i] = heap[parent];
+  }
+  heap[i] = key;
+
+  return TRUE;
+}
+
+static unsigned long long pf_HeapPop(unsigned long long *heap,
+  size_t *count)
+{
+  unsigned long long top = heap[0], last = heap[--(*count)];
+  size_t i = 0, child;
+
+  while ((child = i * 2 + 1) < *count)
+  {
+    if (child + 1 < *count && heap[child + 1] < heap[child]) child++;
+    if (last <= heap[child]) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+
+  return top;
+}
+
+static void pf_SearchBFS(pf_search_t *search, const maze_t *maze,
+  unsigned int from, unsigned int to, const ptrdiff_t *step)
+{
+  unsigned int *queue = (unsigned int*)search->open;
+  unsigned int cell, next, stamp = search->query;
+  size_t head = 0, tail = 1;
+  int d, cx, cy, bits;
+
+  pf_See(search, from, stamp, 0, PF_SOURCE);
+  queue[0] = from;
+  while (head < tail)
+  {
+    cell = queue[head++];
+    if (cell == to)
+    {
+      search->meet = search->meetGoal = cell;
+      search->length = search->dist[cell];
+      break;
+    }
+
+    cy = cell / maze->width;
+    cx = cell - cy * maze->width;
+    bits = pf_Openings(maze, cx, cy);
+    for (d = 0; d < TOTAL_DIRECTIONS; d++)
+    {
+      if (!(bits & DIRECTION_LIST[d])) continue;
+
+      next = (unsigned int)(cell + step[d]);
+      if (search->stamp[next] == stamp) continue;
+      pf_See(search, next, stamp, search->dist[cell] + 1, pf_Opposite[d]);
+      queue[tail++] = next;
+    }
+  }
+  search->numSeen = tail;
+}
+
+// Opens the cell closest to the goal by its estimate first. The estimate
+// never drops along a path, so the first time a cell is closed it has
+// been reached the shortest way, and later entries for it are skipped.
+static void pf_SearchAStar(pf_search_t *search, const maze_t *maze,
+  unsigned int from, unsigned int to, const ptrdiff_t *step)
+{
+  unsigned int cell, next, dist, stamp = search->query;
+  unsigned long long key;
+  size_t count = 0;
+  int d, cx, cy, toX, toY, bits;
+
+  toY = to / maze->width;
+  toX = to - toY * maze->width;
+  cy = from / maze->width;
+  cx = from - cy * maze->width;
+  pf_See(search, from, stamp, 0, PF_SOURCE);
+  search->numSeen = 1;
+  pf_HeapPush(&search->open, &search->openSize, &count,
+    PF_HEAP_KEY(pf_Estimate(cx, cy, toX, toY), from));
+
+  while (count)
+  {
+    key = pf_HeapPop(search->open, &count);
+    cell = PF_HEAP_CELL(key);
+    cy = cell / maze->width;
+    cx = cell - cy * maze->width;
+    dist = search->dist[cell];
+    if (PF_HEAP_ESTIMATE(key) != dist + pf_Estimate(cx, cy, toX, toY))
+    {
+      continue; // opened again since, by a shorter way
+    }
+    if (cell == to)
+    {
+      search->meet = search->meetGoal = cell;
+      search->length = dist;
+      return;
+    }
+
+    bits = pf_Openings(maze, cx, cy);
+    for (d = 0; d < TOTAL_DIRECTIONS; d++)
+    {
+      if (!(bits & DIRECTION_LIST[d])) continue;
+
+      next = (unsigned int)(cell + step[d]);
+      if (search->stamp[next] == stamp && search->dist[next] <= dist + 1)
+      {
+        continue;
+      }
+      if (search->stamp[next] != stamp) search->numSeen++;
+      pf_See(search, next, stamp, dist + 1, pf_Opposite[d]);
+      if (!pf_HeapPush(&search->open, &search->openSize, &count,
+        PF_HEAP_KEY(dist + 1 + pf_Estimate(cx + DIRECTION_DX[d],
+        cy + DIRECTION_DY[d], toX, toY), next))) return;
+    }
+  }
+}
+
+// Grows whichever side has fewer open cells by a whole level at a time.
+// The shortest path through the first level where the sides touch is the
+// shortest path overall.
+static void pf_SearchBidirectional(pf_search_t *search, const maze_t *maze,
+  unsigned int from, unsigned int to, const ptrdiff_t *step)
+{
+  unsigned int *queues[2], cell, next, mine, other;
+  size_t heads[2] = { 0, 0 }, tails[2] = { 1, 1 }, end;
+  long long length;
+  int side, d, cx, cy, bits;
+
+  queues[0] = (unsigned int*)search->open;
+  queues[1] = queues[0] + search->capacity;
+  pf_See(search, from, search->query, 0, PF_SOURCE);
+  pf_See(search, to, search->query + 1, 0, PF_SOURCE);
+  queues[0][0] = from;
+  queues[1][0] = to;
+  if (from == to)
+  {
+    search->meet = search->meetGoal = from;
+    search->length = 0;
+  }
+
+  while (search->length < 0 && heads[0] < tails[0] && heads[1] < tails[1])
+  {
+    side = tails[0] - heads[0] <= tails[1] - heads[1] ? 0 : 1;
+    mine = search->query + side;
+    other = search->query + !side;
+
+    for (end = tails[side]; heads[side] < end; )
+    {
+      cell = queues[side][heads[side]++];
+      cy = cell / maze->width;
+      cx = cell - cy * maze->width;
+      bits = pf_Openings(maze, cx, cy);
+      for (d = 0; d < TOTAL_DIRECTIONS; d++)
+      {
+        if (!(bits & DIRECTION_LIST[d])) continue;
+
+        next = (unsigned int)(cell + step[d]);
+        if (search->stamp[next] == mine) continue;
+        if (search->stamp[next] == other)
+        {
+          length = (long long)search->dist[cell] + 1 + search->dist[next];
+          if (search->length < 0 || length < search->length)
+          {
+            search->length = length;
+            search->meet = side ? next : cell;
+            search->meetGoal = side ? cell : next;
+          }
+          continue;
+        }
+        pf_See(search, next, mine, search->dist[cell] + 1, pf_Opposite[d]);
+        queues[side][tails[side]++] = next;
+      }
+    }
+  }
+  search->numSeen = tails[0] + tails[1];
+}
+
+pf_search_t *pf_SearchCreate(void)
+{
+  return (pf_search_t*)calloc(1, sizeof(pf_search_t));
+}
+
+void pf_SearchFree(pf_search_t *search)
+{
+  if (!search) return;
+
+  free(search->stamp);
+  free(search->dist);
+  free(search->back);
+  free(search->open);
+  free(search);
+}
+
+long long pf_Search(pf_search_t *search, const maze_t *maze, int mode,
+  int fromX, int fromY, int toX, int toY)
+{
+  size_t numCells = (size_t)maze->width * maze->height;
+  unsigned int from, to;
+  ptrdiff_t step[TOTAL_DIRECTIONS];
+  int d;
+
+  search->length = -1;
+  search->numSeen = 0;
+  if (!pf_SearchReserve(search, numCells)) return -1;
+  search->width = maze->width;
+  search->height = maze->height;
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    step[d] = pf_Step(maze->width, d);
+  }
+  pf_NextQuery(search);
+
+  from = (unsigned int)fromY * maze->width + fromX;
+  to = (unsigned int)toY * maze->width + toX;
+  switch (mode)
+  {
+  case PF_SEARCH_ASTAR:
+    pf_SearchAStar(search, maze, from, to, step);
+    break;
+  case PF_SEARCH_BIDIRECTIONAL:
+    pf_SearchBidirectional(search, maze, from, to, step);
+    break;
+  default:
+    pf_SearchBFS(search, maze, from, to, step);
+    break;
+  }
+
+  return search->length;
+}
+
+// The start's side is walked back from the meeting cell and filled in
+// from its end, then the goal's side is walked forward from the other.
+long long pf_SearchPath(const pf_search_t *search, unsigned int *path)
+{
+  long long fromSide, i;
+  size_t cell;
+
+  if (search->length < 0) return 0;
+
+  fromSide = search->dist[search->meet];
+  cell = search->meet;
+  for (i = fromSide; i >= 0; i--)
+  {
+    path[i] = (unsigned int)cell;
+    if (i) cell += pf_Step(search->width, search->back[cell]);
+  }
+
+  if (search->meetGoal != search->meet)
+  {
+    cell = search->meetGoal;
+    for (i = fromSide + 1; i <= search->length; i++)
+    {
+      path[i] = (unsigned int)cell;
+      if (i < search->length)
+      {
+        cell += pf_Step(search->width, search->back[cell]);
+      }
+    }
+  }
+
+  return search->length + 1;
+}
+
+
+// floor(log2(n)) for n > 0
+static int pf_Log2(size_t n)
+{
+  int k = 0;
+
+  while (n >>= 1) k++;
+
+  return k;
+}
+
+// the blocks of a tour through numCells, and the levels of their table
+static size_t pf_TreeBlocks(size_t numCells, int *numLevels)
+{
+  size_t numBlocks = (2 * numCells - 1 + PF_TREE_BLOCK - 1) / PF_TREE_BLOCK;
+
+  *numLevels = pf_Log2(numBlocks) + 1;
+  return numBlocks;
+}
+
+static void pf_TreeRelease(pf_tree_t *tree)
+{
+  free(tree->depth);
+  free(tree->back);
+  free(tree->first);
+  free(tree->last);
+  free(tree->tour);
+  free(tree->blocks);
+  tree->depth = NULL;
+  tree->back = NULL;
+  tree->first = NULL;
+  tree->last = NULL;
+  tree->tour = NULL;
+  tree->blocks = NULL;
+  tree->capacity = 0;
+}
+
+// grows the buffers to hold numCells, keeping them if they already do
+static int pf_TreeReserve(pf_tree_t *tree, size_t numCells)
+{
+  size_t numBlocks;
+  int numLevels;
+
+  if (numCells <= tree->capacity) return TRUE;
+
+  pf_TreeRelease(tree);
+  numBlocks = pf_TreeBlocks(numCells, &numLevels);
+  tree->depth = (unsigned int*)malloc(numCells * sizeof(unsigned int));
+  tree->back = (uint8*)malloc(numCells);
+  tree->first = (unsigned int*)malloc(numCells * sizeof(unsigned int));
+  tree->last = (unsigned int*)malloc(numCells * sizeof(unsigned int));
+  tree->tour = (unsigned int*)malloc(2 * numCells * sizeof(unsigned int));
+  tree->blocks = (unsigned int*)malloc(numBlocks * numLevels *
+    sizeof(unsigned int));
+  if (!tree->depth || !tree->back || !tree->first || !tree->last ||
+    !tree->tour || !tree->blocks)
+  {
+    pf_TreeRelease(tree);
+    return FALSE;
+  }
+  tree->capacity = numCells;
+
+  return TRUE;
+}
+
+static unsigned int pf_Min(unsigned int a, unsigned int b)
+{
+  return a < b ? a : b;
+}
+
+// TRUE if x, y is a cell of the indexed tree
+static int pf_TreeHas(const pf_tree_t *tree, int x, int y)
+{
+  return tree->tourLength && x >= 0 && y >= 0 && x < tree->width &&
+    y < tree->height;
+}
+
+// TRUE if cell is in the subtree hanging from ancestor, or is ancestor
+static int pf_TreeUnder(const pf_tree_t *tree, unsigned int ancestor,
+  unsigned int cell)
+{
+  return tree->first[ancestor] <= tree->first[cell] &&
+    tree->first[cell] <= tree->last[ancestor];
+}
+
+// The depth of the shallowest cell of the tour between the first visits
+// to a and b. The blocks they are in are scanned, and the whole blocks
+// between them are covered by two overlapping runs from the table.
+static unsigned int pf_TreeAncestorDepth(const pf_tree_t *tree,
+  unsigned int a, unsigned int b)
+{
+  size_t i = tree->first[a], j = tree->first[b], lo, hi, k;
+  const unsigned int *row;
+  unsigned int best;
+  int level;
+
+  if (i > j)
+  {
+    k = i;
+    i = j;
+    j = k;
+  }
+  lo = i / PF_TREE_BLOCK;
+  hi = j / PF_TREE_BLOCK;
+  best = tree->tour[i];
+
+  if (lo == hi)
+  {
+    for (k = i + 1; k <= j; k++)
+    {
+      best = pf_Min(best, tree->tour[k]);
+    }
+    return best;
+  }
+
+  for (k = i + 1; k < (lo + 1) * PF_TREE_BLOCK; k++)
+  {
+    best = pf_Min(best, tree->tour[k]);
+  }
+  for (k = hi * PF_TREE_BLOCK; k <= j; k++)
+  {
+    best = pf_Min(best, tree->tour[k]);
+  }
+  if (lo + 1 < hi)
+  {
+    level = pf_Log2(hi - lo - 1);
+    row = tree->blocks + level * tree->numBlocks;
+    best = pf_Min(best, row[lo + 1]);
+    best = pf_Min(best, row[hi - ((size_t)1 << level)]);
+  }
+
+  return best;
+}
+
+pf_tree_t *pf_TreeCreate(void)
+{
+  return (pf_tree_t*)calloc(1, sizeof(pf_tree_t));
+}
+
+void pf_TreeFree(pf_tree_t *tree)
+{
+  if (!tree) return;
+
+  pf_TreeRelease(tree);
+  free(tree);
+}
+
+// Depth first, stepping back along the way each cell was entered instead
+// of keeping a stack. A cell joins the tour when it is entered and again
+// each time the walk comes back to it from one of its children.
+int pf_TreeBuild(pf_tree_t *tree, const maze_t *maze, int x, int y)
+{
+  size_t numCells = (size_t)maze->width * maze->height;
+  size_t t = 0, numReached = 1, b, i, end, span;
+  unsigned int cell, next, depth, *row, *prev;
+  ptrdiff_t step[TOTAL_DIRECTIONS];
+  int d, level, bits;
+
+  tree->tourLength = 0;
+  if (!pf_TreeReserve(tree, numCells)) return FALSE;
+  tree->width = maze->width;
+  tree->height = maze->height;
+  tree->rootX = x;
+  tree->rootY = y;
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    step[d] = pf_Step(maze->width, d);
+  }
+
+  memset(tree->depth, 0xFF, numCells * sizeof(unsigned int));
+  cell = (unsigned int)y * maze->width + x;
+  tree->depth[cell] = 0;
+  tree->back[cell] = PF_SOURCE;
+  tree->first[cell] = 0;
+  tree->tour[t++] = 0;
+  d = 0;
+
+  while (TRUE)
+  {
+    bits = pf_Openings(maze, x, y);
+    for (; d < TOTAL_DIRECTIONS; d++)
+    {
+      if ((bits & DIRECTION_LIST[d]) && d != tree->back[cell]) break;
+    }
+
+    if (d < TOTAL_DIRECTIONS)
+    {
+      next = (unsigned int)(cell + step[d]);
+      if (tree->depth[next] != PF_UNREACHED) return FALSE; // a loop
+      tree->depth[next] = tree->depth[cell] + 1;
+      tree->back[next] = (uint8)pf_Opposite[d];
+      tree->first[next] = (unsigned int)t;
+      tree->tour[t++] = tree->depth[next];
+      numReached++;
+      cell = next;
+      x += DIRECTION_DX[d];
+      y += DIRECTION_DY[d];
+      d = 0;
+    }
+    else
+    {
+      tree->last[cell] = (unsigned int)(t - 1);
+      if (tree->back[cell] == PF_SOURCE) break;
+
+      // carry on with the parent's next direction
+      d = tree->back[cell];
+      cell = (unsigned int)(cell + step[d]);
+      x += DIRECTION_DX[d];
+      y += DIRECTION_DY[d];
+      tree->tour[t++] = tree->depth[cell];
+      d = pf_Opposite[d] + 1;
+    }
+  }
+  if (numReached != numCells) return FALSE;
+
+  tree->numBlocks = pf_TreeBlocks(numCells, &tree->numLevels);
+  for (b = 0; b < tree->numBlocks; b++)
+  {
+    i = b * PF_TREE_BLOCK;
+    end = i + PF_TREE_BLOCK < t ? i + PF_TREE_BLOCK : t;
+    for (depth = tree->tour[i++]; i < end; i++)
+    {
+      depth = pf_Min(depth, tree->tour[i]);
+    }
+    tree->blocks[b] = depth;
+  }
+  for (level = 1; level < tree->numLevels; level++)
+  {
+    span = (size_t)1 << (level - 1);
+    row = tree->blocks + level * tree->numBlocks;
+    prev = row - tree->numBlocks;
+    for (b = 0; b + span * 2 <= tree->numBlocks; b++)
+    {
+      row[b] = pf_Min(prev[b], prev[b + span]);
+    }
+  }
+  tree->tourLength = t;
+
+  return TRUE;
+}
+
+long long pf_TreeDistance(const pf_tree_t *tree, int fromX, int fromY,
+  int toX, int toY)
+{
+  unsigned int from, to;
+
+  if (!pf_TreeHas(tree, fromX, fromY) || !pf_TreeHas(tree, toX, toY))
+  {
+    return -1;
+  }
+
+  from = (unsigned int)fromY * tree->width + fromX;
+  to = (unsigned int)toY * tree->width + toX;
+  return (long long)tree->depth[from] + tree->depth[to] -
+    2LL * pf_TreeAncestorDepth(tree, from, to);
+}
+
+// Heads toward the root unless the other cell hangs below this one, in
+// which case it heads into the child whose subtree holds it.
+int pf_TreeNextStep(const pf_tree_t *tree, int fromX, int fromY,
+  int toX, int toY)
+{
+  unsigned int from, to, child;
+  int d, x, y;
+
+  if (!pf_TreeHas(tree, fromX, fromY) || !pf_TreeHas(tree, toX, toY))
+  {
+    return -1;
+  }
+
+  from = (unsigned int)fromY * tree->width + fromX;
+  to = (unsigned int)toY * tree->width + toX;
+  if (from == to) return -1;
+  if (!pf_TreeUnder(tree, from, to)) return tree->back[from];
+
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    x = fromX + DIRECTION_DX[d];
+    y = fromY + DIRECTION_DY[d];
+    if (x < 0 || y < 0 || x >= tree->width || y >= tree->height) continue;
+
+    child = (unsigned int)(from + pf_Step(tree->width, d));
+    if (tree->back[child] == pf_Opposite[d] &&
+      pf_TreeUnder(tree, child, to)) return d;
+  }
+
+  return -1;
+}
+
+
+// TRUE if the cell is a node of the junction graph
+static int pf_IsNode(const maze_t *maze, int x, int y, int bits)
+{
+  return pf_Degree[bits] != 2 ||
+    (x == maze->startX && y == maze->startY) ||
+    (x == maze->wayX && y == maze->wayY) ||
+    (x == maze->endX && y == maze->endY);
+}
+
+// Follows a corridor from x, y leaving by way, until it reaches a node or
+// has taken limit steps, and writes each cell it reaches to path (if not
+// NULL) stride entries apart. Leaves x, y at the last cell and way as the
+// way of the last step, and returns the number of steps.
+static unsigned int pf_Follow(const maze_t *maze, int *x, int *y, int *way,
+  unsigned int limit, unsigned int *path, ptrdiff_t stride)
+{
+  unsigned int steps = 0;
+  int bits, next;
+
+  while (steps < limit)
+  {
+    *x += DIRECTION_DX[*way];
+    *y += DIRECTION_DY[*way];
+    steps++;
+    if (path)
+    {
+      *path = (unsigned int)*y * maze->width + *x;
+      path += stride;
+    }
+
+    bits = pf_Openings(maze, *x, *y);
+    if (steps == limit || pf_IsNode(maze, *x, *y, bits)) break;
+    next = pf_WayOf[bits & ~DIRECTION_LIST[pf_Opposite[*way]]];
+    if (next < 0) break; // the walls do not match up
+    *way = next;
+  }
+
+  return steps;
+}
+
+static int pf_Grow(unsigned int **block, size_t count)
+{
+  unsigned int *grown = (unsigned int*)realloc(*block,
+    count * sizeof(unsigned int));
+
+  if (!grown) return FALSE;
+  *block = grown;
+  return TRUE;
+}
+
+// grows everything kept per node to hold count nodes
+static int pf_GraphGrowNodes(pf_graph_t *graph, size_t count)
+{
+  size_t capacity = graph->nodeCapacity ? graph->nodeCapacity :
+    PF_MIN_NODES;
+
+  while (capacity < count) capacity *= 2;
+  if (capacity == graph->nodeCapacity) return TRUE;
+
+  if (!pf_Grow(&graph->cells, capacity) ||
+    !pf_Grow(&graph->firstEdge, capacity) ||
+    !pf_Grow(&graph->stamp, capacity) ||
+    !pf_Grow(&graph->dist, capacity) ||
+    !pf_Grow(&graph->prevNode, capacity) ||
+    !pf_Grow(&graph->prevEdge, capacity)) return FALSE;
+  graph->nodeCapacity = capacity;
+
+  return TRUE;
+}
+
+// Grows the edges and the heap. Every edge is followed at most once by a
+// search, and the start's ends add two more entries.
+static int pf_GraphGrowEdges(pf_graph_t *graph, size_t count)
+{
+  pf_edge_t *edges;
+  unsigned long long *open;
+
+  if (count <= graph->edgeCapacity) return TRUE;
+
+  edges = (pf_edge_t*)realloc(graph->edges, count * sizeof(pf_edge_t));
+  if (!edges) return FALSE;
+  graph->edges = edges;
+  open = (unsigned long long*)realloc(graph->open,
+    (count + 2) * sizeof(unsigned long long));
+  if (!open) return FALSE;
+  graph->open = open;
+  graph->edgeCapacity = count;
+  graph->openSize = count + 2;
+
+  return TRUE;
+}
+
+// the node at cell, found by a binary search of the sorted cells
+static unsigned int pf_GraphFind(const pf_graph_t *graph, unsigned int cell)
+{
+  size_t lo = 0, hi = graph->numNodes, mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (graph->cells[mid] < cell) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo < graph->numNodes && graph->cells[lo] == cell ?
+    (unsigned int)lo : PF_NO_NODE;
+}
+
+// fills in the ends of the corridor holding x, y
+static void pf_GraphLocate(const pf_graph_t *graph, const maze_t *maze,
+  int x, int y, pf_end_t *ends)
+{
+  unsigned int limit = (unsigned int)graph->width * graph->height;
+  int bits = pf_Openings(maze, x, y), d, k = 0, endX, endY, way;
+
+  ends[0].node = ends[1].node = PF_NO_NODE;
+  if (pf_IsNode(maze, x, y, bits))
+  {
+    ends[0].node = pf_GraphFind(graph, (unsigned int)y * graph->width + x);
+    ends[0].steps = 0;
+    ends[0].wayOut = ends[0].wayIn = 0;
+    return;
+  }
+
+  for (d = 0; d < TOTAL_DIRECTIONS && k < 2; d++)
+  {
+    if (!(bits & DIRECTION_LIST[d])) continue;
+
+    endX = x;
+    endY = y;
+    way = d;
+    ends[k].steps = pf_Follow(maze, &endX, &endY, &way, limit, NULL, 0);
+    ends[k].node = pf_GraphFind(graph,
+      (unsigned int)endY * graph->width + endX);
+    ends[k].wayOut = (uint8)pf_Opposite[way];
+    ends[k].wayIn = (uint8)d;
+    k++;
+  }
+}
+
+// records a shorter way to node and opens it
+static void pf_GraphReach(pf_graph_t *graph, size_t *count,
+  unsigned int node, unsigned int dist, unsigned int prevNode,
+  unsigned int prevEdge)
+{
+  if (graph->stamp[node] == graph->query && graph->dist[node] <= dist)
+  {
+    return;
+  }
+
+  graph->stamp[node] = graph->query;
+  graph->dist[node] = dist;
+  graph->prevNode[node] = prevNode;
+  graph->prevEdge[node] = prevEdge;
+  pf_HeapPush(&graph->open, &graph->openSize, count,
+    PF_HEAP_KEY(dist, node));
+}
+
+pf_graph_t *pf_GraphCreate(void)
+{
+  return (pf_graph_t*)calloc(1, sizeof(pf_graph_t));
+}
+
+void pf_GraphFree(pf_graph_t *graph)
+{
+  if (!graph) return;
+
+  free(graph->cells);
+  free(graph->firstEdge);
+  free(graph->edges);
+  free(graph->stamp);
+  free(graph->dist);
+  free(graph->prevNode);
+  free(graph->prevEdge);
+  free(graph->open);
+  free(graph);
+}
+
+int pf_GraphBuild(pf_graph_t *graph, const maze_t *maze)
+{
+  unsigned int limit = (unsigned int)maze->width * maze->height;
+  size_t numNodes = 0, numEdges = 0, i, e;
+  unsigned int cell;
+  int x, y, d, bits, endX, endY, way;
+
+  graph->numNodes = 0;
+  graph->numEdges = 0;
+  graph->length = -1;
+  graph->width = maze->width;
+  graph->height = maze->height;
+
+  for (y = 0; y < maze->height; y++)
+  {
+    for (x = 0; x < maze->width; x++)
+    {
+      bits = pf_Openings(maze, x, y);
+      if (!pf_IsNode(maze, x, y, bits)) continue;
+
+      // one more for the end of the last node's edges
+      if (!pf_GraphGrowNodes(graph, numNodes + 2)) return FALSE;
+      graph->cells[numNodes] = (unsigned int)y * maze->width + x;
+      graph->firstEdge[numNodes++] = (unsigned int)numEdges;
+      numEdges += pf_Degree[bits];
+    }
+  }
+  if (!pf_GraphGrowNodes(graph, numNodes + 1) ||
+    !pf_GraphGrowEdges(graph, numEdges)) return FALSE;
+  graph->firstEdge[numNodes] = (unsigned int)numEdges;
+  graph->numNodes = numNodes;
+
+  for (i = 0; i < numNodes; i++)
+  {
+    cell = graph->cells[i];
+    y = cell / maze->width;
+    x = cell - y * maze->width;
+    bits = pf_Openings(maze, x, y);
+    e = graph->firstEdge[i];
+
+    for (d = 0; d < TOTAL_DIRECTIONS; d++)
+    {
+      if (!(bits & DIRECTION_LIST[d])) continue;
+
+      endX = x;
+      endY = y;
+      way = d;
+      graph->edges[e].way = (uint8)d;
+      graph->edges[e].length = pf_Follow(maze, &endX, &endY, &way, limit,
+        NULL, 0);
+      graph->edges[e].to = pf_GraphFind(graph,
+        (unsigned int)endY * maze->width + endX);
+      graph->edges[e].wayBack = (uint8)pf_Opposite[way];
+      e++;
+    }
+  }
+  graph->numEdges = numEdges;
+
+  memset(graph->stamp, 0, numNodes * sizeof(unsigned int));
+  graph->query = 0;
+
+  return TRUE;
+}
+
+long long pf_GraphSearch(pf_graph_t *graph, const maze_t *maze,
+  int fromX, int fromY, int toX, int toY)
+{
+  unsigned long long key;
+  unsigned int node, dist, e;
+  size_t count = 0;
+  long long length;
+  int k;
+
+  graph->length = -1;
+  graph->toEnd = -1;
+  if (!graph->numNodes) return -1;
+
+  graph->fromCell = (unsigned int)fromY * graph->width + fromX;
+  graph->toCell = (unsigned int)toY * graph->width + toX;
+  pf_GraphLocate(graph, maze, fromX, fromY, graph->from);
+  pf_GraphLocate(graph, maze, toX, toY, graph->to);
+  if (++graph->query == 0)
+  {
+    memset(graph->stamp, 0, graph->numNodes * sizeof(unsigned int));
+    graph->query = 1;
+  }
+
+  // both on one corridor, where the path may never reach a node
+  for (k = 0; k < 2 && graph->from[0].steps; k++)
+  {
+    if (graph->to[k].node == graph->from[0].node && graph->to[k].steps &&
+      graph->to[k].wayOut == graph->from[0].wayOut)
+    {
+      graph->length = graph->to[k].steps > graph->from[0].steps ?
+        graph->to[k].steps - graph->from[0].steps :
+        graph->from[0].steps - graph->to[k].steps;
+    }
+  }
+
+  for (k = 0; k < 2; k++)
+  {
+    if (graph->from[k].node == PF_NO_NODE) continue;
+    pf_GraphReach(graph, &count, graph->from[k].node, graph->from[k].steps,
+      PF_NO_NODE, k);
+  }
+
+  while (count)
+  {
+    key = pf_HeapPop(graph->open, &count);
+    node = PF_HEAP_CELL(key);
+    dist = PF_HEAP_ESTIMATE(key);
+    if (dist != graph->dist[node]) continue; // reached again since
+    if (graph->length >= 0 && dist >= graph->length) break;
+
+    for (k = 0; k < 2; k++)
+    {
+      if (graph->to[k].node != node) continue;
+
+      length = (long long)dist + graph->to[k].steps;
+      if (graph->length < 0 || length < graph->length)
+      {
+        graph->length = length;
+        graph->toEnd = k;
+      }
+    }
+
+    for (e = graph->firstEdge[node]; e < graph->firstEdge[node + 1]; e++)
+    {
+      if (graph->edges[e].to == PF_NO_NODE) continue;
+      pf_GraphReach(graph, &count, graph->edges[e].to,
+        dist + graph->edges[e].length, node, e);
+    }
+  }
+
+  return graph->length;
+}
+
+// The corridor into the goal is written first, then every edge of the
+// path is walked back from its far end, and last the corridor out of the
+// start fills in the front.
+long long pf_GraphPath(const pf_graph_t *graph, const maze_t *maze,
+  unsigned int *path)
+{
+  const pf_end_t *end;
+  const pf_edge_t *edge;
+  long long pos;
+  unsigned int node;
+  int x, y, way, k;
+
+  if (graph->length < 0) return 0;
+
+  path[0] = graph->fromCell;
+  y = graph->fromCell / graph->width;
+  x = graph->fromCell - y * graph->width;
+  if (graph->toEnd < 0)
+  {
+    // head for whichever end of the corridor the goal is closer to
+    for (k = 0; graph->to[k].wayOut != graph->from[0].wayOut ||
+      graph->to[k].node != graph->from[0].node; k++);
+    way = graph->to[k].steps < graph->from[0].steps ?
+      graph->from[0].wayIn : graph->from[1].wayIn;
+    pf_Follow(maze, &x, &y, &way, (unsigned int)graph->length, path + 1, 1);
+    return graph->length + 1;
+  }
+
+  end = &graph->to[graph->toEnd];
+  node = end->node;
+  pos = graph->length - end->steps;
+  path[pos] = graph->cells[node];
+  y = graph->cells[node] / graph->width;
+  x = graph->cells[node] - y * graph->width;
+  way = end->wayOut;
+  pf_Follow(maze, &x, &y, &way, end->steps, path + pos + 1, 1);
+
+  while (graph->prevNode[node] != PF_NO_NODE)
+  {
+    edge = &graph->edges[graph->prevEdge[node]];
+    y = graph->cells[node] / graph->width;
+    x = graph->cells[node] - y * graph->width;
+    way = edge->wayBack;
+    pf_Follow(maze, &x, &y, &way, edge->length, path + pos - 1, -1);
+    pos -= edge->length;
+    node = graph->prevNode[node];
+  }
+
+  end = &graph->from[graph->prevEdge[node]];
+  y = graph->fromCell / graph->width;
+  x = graph->fromCell - y * graph->width;
+  way = end->wayIn;
+  pf_Follow(maze, &x, &y, &way, end->steps, path + 1, 1);
+
+  return graph->length + 1;
+}
+
+
+// Appends a cell to one of a thread's frontier lists, growing it if full.
+static int pf_FrontierPush(pf_frontier_t *frontier, int which,
+  unsigned int cell)
+{
+  size_t size = frontier->size[which];
+
+  if (frontier->count[which] == size)
+  {
+    size = size ? size * 2 : PF_MIN_FRONTIER;
+    if (!pf_Grow(&frontier->list[which], size)) return FALSE;
+    frontier->size[which] = size;
+  }
+  frontier->list[which][frontier->count[which]++] = cell;
+
+  return TRUE;
+}
+
+// Claims a cell for parent, unless it already has a distance or a parent
+// earlier in the frontier claimed it first. Returns TRUE if parent holds
+// the claim, for now.
+static int pf_Claim(pf_flood_t *flood, unsigned int cell,
+  unsigned int parent)
+{
+  unsigned int old = 0, was;
+
+  if (PF_SEEN(flood->seen, cell)) return FALSE;
+
+  while (!old || old > parent)
+  {
+    was = th_AtomicCompareSwap(&flood->claim[cell], old, parent);
+    if (was == old) return TRUE;
+    old = was;
+  }
+
+  return FALSE;
+}
+
+// Claims the cells one cell of the frontier, at index in the level, leads
+// to and notes the ones it got on thread t.
+static void pf_FloodCell(pf_flood_t *flood, int t, const pf_level_t *level,
+  unsigned int cell, size_t index)
+{
+  const maze_t *maze = flood->maze;
+  pf_frontier_t *own = &flood->frontiers[t];
+  unsigned long long *found;
+  unsigned int next, parent = (unsigned int)(level->start + index) + 1;
+  int d, cy = cell / maze->width;
+  int bits = pf_Openings(maze, cell - cy * maze->width, cy);
+  size_t size;
+
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    if (!(bits & DIRECTION_LIST[d])) continue;
+
+    next = (unsigned int)(cell + flood->step[d]);
+    if (!pf_Claim(flood, next, parent)) continue;
+
+    if (own->numFound == own->foundSize)
+    {
+      size = own->foundSize ? own->foundSize * 2 : PF_MIN_FRONTIER;
+      found = (unsigned long long*)realloc(own->found,
+        size * sizeof(unsigned long long));
+      if (!found)
+      {
+        th_AtomicIncrement(&flood->numFailed);
+        continue;
+      }
+      own->found = found;
+      own->foundSize = size;
+    }
+    own->found[own->numFound++] = PF_FOUND(parent, next, d);
+  }
+}
+
+// Thread t's share of the first pass over a wide level, which leaves every
+// cell the frontier reaches claimed by its earliest parent. Each thread
+// notes the cells it claims in the order a serial flood would reach them,
+// but a thread with an earlier share can still take some of them away.
+static void pf_FloodClaim(pf_flood_t *flood, int t, const pf_level_t *level)
+{
+  size_t lo = level->size * t / flood->numThreads;
+  size_t hi = level->size * (t + 1) / flood->numThreads;
+  size_t first = 0, i, count;
+  const unsigned int *list;
+  int k;
+
+  flood->frontiers[t].numFound = 0;
+  if (level->bQueued)
+  {
+    list = flood->field->queue + level->start;
+    for (; lo < hi; lo++) pf_FloodCell(flood, t, level, list[lo], lo);
+    return;
+  }
+
+  for (k = 0; k < flood->numThreads && lo < hi; k++)
+  {
+    count = flood->frontiers[k].count[level->cur];
+    list = flood->frontiers[k].list[level->cur];
+    for (i = lo - first; i < count && lo < hi; i++, lo++)
+    {
+      pf_FloodCell(flood, t, level, list[i], lo);
+    }
+    first += count;
+  }
+}
+
+// The second pass, once every claim is in. Thread t keeps the cells it
+// still holds, gives them their distance and way back, and queues them
+// on its frontier. Taking the threads' frontiers in order then gives the
+// cells in the order pf_Flood queues them, with the same ways back.
+static void pf_FloodKeep(pf_flood_t *flood, int t, const pf_level_t *level)
+{
+  pf_frontier_t *own = &flood->frontiers[t];
+  pf_field_t *field = flood->field;
+  unsigned long long found;
+  unsigned int cell;
+  size_t i;
+
+  own->count[!level->cur] = 0;
+  for (i = 0; i < own->numFound; i++)
+  {
+    found = own->found[i];
+    cell = PF_FOUND_CELL(found);
+    if (flood->claim[cell] != PF_FOUND_PARENT(found)) continue;
+
+    field->dist[cell] = level->dist + 1;
+    field->back[cell] = (uint8)pf_Opposite[PF_FOUND_WAY(found)];
+    th_AtomicOr(&flood->seen[cell >> 5], PF_SEEN_BIT(cell));
+    if (!pf_FrontierPush(own, !level->cur, cell))
+    {
+      th_AtomicIncrement(&flood->numFailed);
+    }
+  }
+}
+
+// Moves thread t on to the level the threads just found, and copies its
+// part of it into the queue.
+static void pf_FloodNext(pf_flood_t *flood, int t, pf_level_t *level)
+{
+  pf_frontier_t *own = &flood->frontiers[t];
+  int k, next = !level->cur;
+  size_t before = 0, size = 0;
+
+  for (k = 0; k < flood->numThreads; k++)
+  {
+    if (k < t) before += flood->frontiers[k].count[next];
+    size += flood->frontiers[k].count[next];
+  }
+  memcpy(&flood->field->queue[level->start + level->size + before],
+    own->list[next], own->count[next] * sizeof(unsigned int));
+
+  level->start += level->size;
+  level->size = size;
+  level->dist++;
+  level->cur = next;
+  level->bQueued = FALSE;
+}
+
+// Expands the levels that are too narrow to be worth splitting on thread 0
+// alone, straight from the queue the way pf_Flood does, while the other
+// threads wait. Then hands the first wide level over to all of them, or
+// ends the flood.
+static void pf_FloodNarrow(pf_flood_t *flood, pf_level_t *level)
+{
+  const maze_t *maze = flood->maze;
+  pf_field_t *field = flood->field;
+  size_t head = level->start, tail = level->start + level->size;
+  unsigned int cell, next;
+  int d, cx, cy, bits;
+
+  if (level->size >= PF_PARALLEL_LEVEL || flood->numFailed)
+  {
+    flood->level = *level;
+    flood->bDone = !level->size || flood->numFailed;
+    return;
+  }
+
+  while (head < tail)
+  {
+    cell = field->queue[head++];
+    cy = cell / maze->width;
+    cx = cell - cy * maze->width;
+    bits = pf_Openings(maze, cx, cy);
+
+    for (d = 0; d < TOTAL_DIRECTIONS; d++)
+    {
+      if (!(bits & DIRECTION_LIST[d])) continue;
+
+      next = (unsigned int)(cell + flood->step[d]);
+      if (PF_SEEN(flood->seen, next)) continue;
+      flood->seen[next >> 5] |= PF_SEEN_BIT(next);
+      field->dist[next] = field->dist[cell] + 1;
+      field->back[next] = (uint8)pf_Opposite[d];
+      field->queue[tail++] = next;
+    }
+
+    // a level ends where the next one starts
+    if (head == level->start + level->size)
+    {
+      level->start = head;
+      level->size = tail - head;
+      level->dist++;
+      if (level->size >= PF_PARALLEL_LEVEL) break;
+    }
+  }
+
+  level->bQueued = TRUE;
+  flood->level = *level;
+  flood->bDone = !level->size;
+}
+
+// The flood as seen by thread t, which every thread runs until it is done.
+// Each thread keeps its own copy of the level, which they all move on in
+// step, so only thread 0 writes to the shared one.
+static void pf_FloodLevels(pf_flood_t *flood, int t)
+{
+  pf_level_t level;
+
+  memset(&level, 0, sizeof(level));
+  if (!t) level = flood->level;
+
+  for (;;)
+  {
+    if (!t) pf_FloodNarrow(flood, &level);
+    th_BarrierWait(flood->barrier);
+    if (flood->bDone) return;
+    level = flood->level;
+
+    do
+    {
+      pf_FloodClaim(flood, t, &level);
+      th_BarrierWait(flood->barrier);
+      pf_FloodKeep(flood, t, &level);
+      th_BarrierWait(flood->barrier);
+      pf_FloodNext(flood, t, &level);
+    } while (level.size >= PF_PARALLEL_LEVEL &&
+      !th_AtomicGet(&flood->numFailed));
+
+    // the lists must be left alone until every thread has counted them
+    th_BarrierWait(flood->barrier);
+  }
+}
+
+static void pf_FloodWorker(void *arg)
+{
+  pf_flood_t *flood = (pf_flood_t*)arg;
+
+  // held until every thread that could be started has been counted
+  th_Lock(flood->gate);
+  th_Unlock(flood->gate);
+
+  if (flood->barrier)
+  {
+    pf_FloodLevels(flood, th_AtomicIncrement(&flood->nextThread));
+  }
+}
+
+// Anything that goes wrong setting the threads up falls back on pf_Flood,
+// which needs no memory beyond the field.
+int pf_FloodParallel(pf_field_t *field, const maze_t *maze, int x, int y,
+  int numThreads)
+{
+  size_t numCells = (size_t)maze->width * maze->height;
+  unsigned int cell = (unsigned int)y * maze->width + x;
+  thread_t **threads;
+  pf_flood_t flood;
+  int i, d, started = 0, bFlooded = FALSE;
+
+  if (numThreads <= 0) numThreads = th_NumCores();
+  if (numThreads < 2 || numCells < PF_PARALLEL_CELLS)
+  {
+    return pf_Flood(field, maze, x, y);
+  }
+
+  field->numReached = 0;
+  if (!pf_Reserve(field, numCells)) return FALSE;
+
+  memset(&flood, 0, sizeof(flood));
+  flood.field = field;
+  flood.maze = maze;
+  for (d = 0; d < TOTAL_DIRECTIONS; d++)
+  {
+    flood.step[d] = pf_Step(maze->width, d);
+  }
+  flood.seen = (unsigned int*)calloc((numCells + 31) / 32,
+    sizeof(unsigned int));
+  flood.claim = (unsigned int*)calloc(numCells, sizeof(unsigned int));
+  flood.frontiers = (pf_frontier_t*)calloc(numThreads,
+    sizeof(pf_frontier_t));
+  threads = (thread_t**)malloc(sizeof(thread_t*) * (numThreads - 1));
+  flood.gate = th_MutexCreate();
+
+  if (flood.seen && flood.claim && flood.frontiers && threads &&
+    flood.gate)
+  {
+    field->width = maze->width;
+    field->height = maze->height;
+    field->sourceX = x;
+    field->sourceY = y;
+    memset(field->dist, 0xFF, numCells * sizeof(unsigned int));
+    field->dist[cell] = 0;
+    field->back[cell] = PF_SOURCE;
+    field->queue[0] = cell;
+    flood.seen[cell >> 5] |= PF_SEEN_BIT(cell);
+    flood.level.size = 1;
+    flood.level.bQueued = TRUE;
+
+    th_Lock(flood.gate);
+    for (; started < numThreads - 1; started++)
+    {
+      threads[started] = th_Create(pf_FloodWorker, &flood);
+      if (!threads[started]) break;
+    }
+    flood.numThreads = started + 1;
+    flood.barrier = th_BarrierCreate(flood.numThreads);
+    th_Unlock(flood.gate);
+
+    if (flood.barrier)
+    {
+      pf_FloodLevels(&flood, 0);
+      bFlooded = !flood.numFailed;
+    }
+    for (i = 0; i < started; i++) th_Join(threads[i]);
+  }
+
+  for (i = 0; flood.frontiers && i < numThreads; i++)
+  {
+    free(flood.frontiers[i].list[0]);
+    free(flood.frontiers[i].list[1]);
+    free(flood.frontiers[i].found);
+  }
+  free(flood.frontiers);
+  free((void*)flood.seen);
+  free((void*)flood.claim);
+  free(threads);
+  th_MutexDestroy(flood.gate);
+  th_BarrierDestroy(flood.barrier);
+
+  if (!bFlooded) return pf_Flood(field, maze, x, y);
+  field->numReached = flood.level.start;
+
+  return TRUE;
+}
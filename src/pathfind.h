@@ -0,0 +1,213 @@
+#pragma once
+
+#ifndef PF_PATHFIND_H
+#define PF_PATHFIND_H
+
+#include "mazegen.h"
+
+#define PF_UNREACHED 0xFFFFFFFFU // distance of a cell the flood never got to
+#define PF_SOURCE 4 // way back from the cell the flood started at
+
+// ways of answering pf_Search
+#define PF_SEARCH_BFS 0   // breadth first from the start until the goal
+#define PF_SEARCH_ASTAR 1 // A* with the Manhattan distance to the goal
+#define PF_SEARCH_BIDIRECTIONAL 2 // breadth first from both ends at once
+#define PF_NUM_SEARCHES 3
+
+#define PF_TREE_BLOCK 32 // tour entries scanned directly by a tree query
+
+#define PF_NO_NODE 0xFFFFFFFFU
+
+// Steps from one cell to every other, filled in by pf_Flood. Cells are
+// numbered y * width + x. Nothing in it points into the maze, so the maze
+// can be freed once it has been flooded.
+typedef struct
+{
+  int width, height;
+  int sourceX, sourceY;
+  unsigned int *dist;  // steps from the source, PF_UNREACHED if none
+  uint8 *back;         // the way back as an index into DIRECTION_LIST
+  unsigned int *queue; // cells in the order they were reached
+  size_t numReached;   // the last one reached is the farthest away
+  size_t capacity;     // cells the buffers can hold
+} pf_field_t;
+
+// The way toward the goal from every cell, see pf_HintsBuild. Packed four
+// cells to a byte, it takes a quarter of the memory of a field's ways back
+// and none of its distances, so it can be kept for as long as the maze.
+typedef struct
+{
+  int width, height;
+  int goalX, goalY;
+  uint8 *ways;     // indices into DIRECTION_LIST, 2 bits a cell in row order
+  size_t capacity; // bytes ways can hold
+} pf_hints_t;
+
+// Scratch for point to point queries, see pf_Search. A cell only counts
+// as seen if its stamp belongs to the current query, so nothing has to be
+// cleared between queries and each one only touches the cells it looks at.
+typedef struct
+{
+  int width, height;
+  unsigned int *stamp; // query that saw the cell, +1 if from the goal's side
+  unsigned int *dist;  // steps from the side that saw it
+  uint8 *back;         // the way back to that side, see pf_field_t
+  unsigned long long *open; // the A* heap, or both breadth first queues
+  size_t capacity;     // cells the buffers can hold
+  size_t openSize;     // entries open can hold
+  unsigned int query;
+  size_t numSeen;      // cells the last query looked at
+  long long length;    // steps the last query found, -1 if none
+  unsigned int meet;   // cell where the two sides of the path join
+  unsigned int meetGoal; // the goal's side of it, the same if only one
+} pf_search_t;
+
+// A perfect maze indexed as a tree hanging from one cell, see pf_TreeBuild.
+// The closest common ancestor of two cells is the shallowest cell between
+// them in the tour, and its depth is found with a sparse table of the
+// least depth in each run of blocks of PF_TREE_BLOCK entries.
+typedef struct
+{
+  int width, height;
+  int rootX, rootY;
+  unsigned int *depth; // steps from the root
+  uint8 *back;         // the way toward the root, see pf_field_t
+  unsigned int *first, *last; // where the cell's subtree starts and ends
+  unsigned int *tour;  // depths of the cells as a depth first walk passes
+  size_t tourLength;
+  unsigned int *blocks; // by level, the least depth in 2^level blocks
+  size_t numBlocks;
+  int numLevels;
+  size_t capacity;     // cells the buffers can hold
+} pf_tree_t;
+
+// A corridor of the junction graph, as seen from the node it leaves.
+typedef struct
+{
+  unsigned int to;     // node at the far end
+  unsigned int length; // steps along it
+  uint8 way;           // the way it leaves the node, see pf_field_t
+  uint8 wayBack;       // the way it leaves the far node, back along it
+} pf_edge_t;
+
+// One end of the corridor holding a cell. A cell that is a node is its
+// own only end, with no steps.
+typedef struct
+{
+  unsigned int node;  // PF_NO_NODE if there is no such end
+  unsigned int steps; // from the cell to the node
+  uint8 wayOut;       // the way from the node toward the cell
+  uint8 wayIn;        // the way from the cell toward the node
+} pf_end_t;
+
+// A maze with every corridor contracted into a single edge, see
+// pf_GraphBuild. The nodes are the cells without exactly two openings
+// (dead ends and junctions) along with the start, waypoint and exit.
+typedef struct
+{
+  int width, height;
+  size_t numNodes, numEdges;
+  unsigned int *cells;     // cell of each node, in increasing order
+  unsigned int *firstEdge; // node i has edges firstEdge[i] to [i + 1] - 1
+  pf_edge_t *edges;
+  size_t nodeCapacity, edgeCapacity;
+
+  // scratch for pf_GraphSearch, stamped like pf_search_t's
+  unsigned int *stamp, *dist;
+  unsigned int *prevNode; // PF_NO_NODE where the path starts
+  unsigned int *prevEdge; // or the index into from it starts with
+  unsigned long long *open;
+  size_t openSize;
+  unsigned int query;
+
+  // the last search
+  long long length;   // -1 if it found no path
+  unsigned int fromCell, toCell;
+  pf_end_t from[2], to[2];
+  int toEnd;          // end of to the path arrives by, -1 if none is used
+} pf_graph_t;
+
+pf_field_t *pf_Create(void); // NULL if out of memory
+void pf_Free(pf_field_t *field);
+
+// Breadth first from x, y over the maze's openings, for packed mazes too,
+// without writing to the maze or recursing. The buffers only grow, so
+// flooding a maze no bigger than the last one allocates nothing. Returns
+// FALSE if they could not be grown.
+int pf_Flood(pf_field_t *field, const maze_t *maze, int x, int y);
+
+// pf_Flood split across numThreads threads (0 = one per core), one level
+// of the flood at a time. Each thread expands a share of the level and
+// queues what it finds on a frontier of its own, and the cells every
+// thread reaches are marked in an atomic bitset. The field comes out the
+// same as pf_Flood's for any number of threads. Small mazes and levels
+// too narrow to split are flooded serially, so it is never much slower.
+int pf_FloodParallel(pf_field_t *field, const maze_t *maze, int x, int y,
+  int numThreads);
+
+long long pf_Distance(const pf_field_t *field, int x, int y); // -1 if none
+int pf_WayBack(const pf_field_t *field, int x, int y); // -1 if none
+// Writes the cells from the source to x, y into path, which must have
+// room for pf_Distance + 1 of them, and returns how many it wrote.
+long long pf_Path(const pf_field_t *field, int x, int y, unsigned int *path);
+
+pf_hints_t *pf_HintsCreate(void); // NULL if out of memory
+void pf_HintsFree(pf_hints_t *hints);
+
+// Packs the ways back of a field flooded from the goal, after which the
+// field can be flooded again or freed. Returns FALSE if out of memory or
+// the field is empty, leaving hints with no cells.
+int pf_HintsBuild(pf_hints_t *hints, const pf_field_t *field);
+// the way from x, y toward the goal as an index into DIRECTION_LIST, or -1
+// at the goal or outside the maze. Cells the flood never reached, which
+// can not lead to the goal, get a way that means nothing.
+int pf_HintWay(const pf_hints_t *hints, int x, int y);
+
+pf_search_t *pf_SearchCreate(void); // NULL if out of memory
+void pf_SearchFree(pf_search_t *search);
+
+// Finds the number of steps from one cell to another with a PF_SEARCH_*
+// mode, or -1 if there is no path or the buffers could not be grown. Like
+// pf_Flood it never writes to the maze, and once the buffers have grown
+// to fit the maze a query allocates nothing.
+long long pf_Search(pf_search_t *search, const maze_t *maze, int mode,
+  int fromX, int fromY, int toX, int toY);
+// Writes the cells of the path the last pf_Search found into path, which
+// must have room for its length + 1 of them, and returns how many.
+long long pf_SearchPath(const pf_search_t *search, unsigned int *path);
+
+pf_tree_t *pf_TreeCreate(void); // NULL if out of memory
+void pf_TreeFree(pf_tree_t *tree);
+
+// Walks the maze once from x, y, without recursing, and indexes it so the
+// distance between any two cells takes a constant number of table lookups
+// and two short scans. Returns FALSE if the buffers could not be grown or
+// the maze is not a tree, that is if it has loops or cells that can not
+// be reached. The buffers are reused like pf_Flood's.
+int pf_TreeBuild(pf_tree_t *tree, const maze_t *maze, int x, int y);
+long long pf_TreeDistance(const pf_tree_t *tree, int fromX, int fromY,
+  int toX, int toY);
+// the way from one cell toward the other as an index into DIRECTION_LIST,
+// or -1 if they are the same cell
+int pf_TreeNextStep(const pf_tree_t *tree, int fromX, int fromY,
+  int toX, int toY);
+
+pf_graph_t *pf_GraphCreate(void); // NULL if out of memory
+void pf_GraphFree(pf_graph_t *graph);
+
+// Finds the nodes in one pass over the cells, then walks every corridor
+// from both of its ends. Returns FALSE if out of memory. The graph is only
+// good for the maze it was built from, which every other pf_Graph call
+// must be handed, and its buffers are reused like pf_Flood's.
+int pf_GraphBuild(pf_graph_t *graph, const maze_t *maze);
+// Dijkstra over the nodes between any two cells, stepping into the graph
+// along the corridors that hold them. Returns the number of steps, or -1
+// if there is no path, and never allocates.
+long long pf_GraphSearch(pf_graph_t *graph, const maze_t *maze,
+  int fromX, int fromY, int toX, int toY);
+// Expands the path the last pf_GraphSearch found into its cells, like
+// pf_SearchPath.
+long long pf_GraphPath(const pf_graph_t *graph, const maze_t *maze,
+  unsigned int *path);
+
+#endif // PF_PATHFIND_H
\ No newline at end of file
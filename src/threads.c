@@ -0,0 +1,341 @@
+#include "threads.h"
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#ifdef linux
+#include <pthread.h>
+#include <unistd.h>
+#endif
+// every function below only has a Windows and a linux body, so anything
+// else would build threads that never run and atomics that return junk
+#if !defined(_WIN32) && !defined(linux)
+#error "threads.c: unsupported platform"
+#endif
+
+#define TH_BARRIER_SPINS 4096 // looks at a barrier before sleeping on it
+
+struct thread_s
+{
+#ifdef _WIN32
+  HANDLE handle;
+#endif
+#ifdef linux
+  pthread_t handle;
+#endif
+  th_func_t func;
+  void *arg;
+};
+
+struct mutex_s
+{
+#ifdef _WIN32
+  CRITICAL_SECTION section;
+#endif
+#ifdef linux
+  pthread_mutex_t handle;
+#endif
+};
+
+struct cond_s
+{
+#ifdef _WIN32
+  CONDITION_VARIABLE handle;
+#endif
+#ifdef linux
+  pthread_cond_t handle;
+#endif
+};
+
+struct barrier_s
+{
+  mutex_t *mutex;
+  cond_t *cond;
+  int count;   // threads that meet at it
+  int waiting; // threads that have arrived this round
+  volatile int round;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI th_Start(LPVOID param)
+{
+  thread_t *thread = (thread_t*)param;
+  thread->func(thread->arg);
+  return 0;
+}
+#endif
+
+#ifdef linux
+static void *th_Start(void *param)
+{
+  thread_t *thread = (thread_t*)param;
+  thread->func(thread->arg);
+  return NULL;
+}
+#endif
+
+thread_t *th_Create(th_func_t func, void *arg)
+{
+  thread_t *thread = (thread_t*)malloc(sizeof(thread_t));
+
+  if (!thread) return NULL;
+  thread->func = func;
+  thread->arg = arg;
+
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, th_Start, thread, 0, NULL);
+  if (!thread->handle)
+  {
+    free(thread);
+    return NULL;
+  }
+#endif
+#ifdef linux
+  if (pthread_create(&thread->handle, NULL, th_Start, thread))
+  {
+    free(thread);
+    return NULL;
+  }
+#endif
+
+  return thread;
+}
+
+void th_Join(thread_t *thread)
+{
+  if (!thread) return;
+
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#endif
+#ifdef linux
+  pthread_join(thread->handle, NULL);
+#endif
+
+  free(thread);
+}
+
+int th_NumCores(void)
+{
+  int cores = 1;
+
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  cores = (int)info.dwNumberOfProcessors;
+#endif
+#ifdef linux
+  cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+  return cores > 0 ? cores : 1;
+}
+
+int th_AtomicIncrement(volatile int *value)
+{
+#ifdef _WIN32
+  return (int)InterlockedIncrement((volatile LONG*)value);
+#endif
+#ifdef linux
+  return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+int th_AtomicGet(volatile int *value)
+{
+#ifdef _WIN32
+  return (int)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#endif
+#ifdef linux
+  return __sync_add_and_fetch(value, 0);
+#endif
+}
+
+unsigned int th_AtomicOr(volatile unsigned int *value, unsigned int bits)
+{
+#ifdef _WIN32
+  return (unsigned int)InterlockedOr((volatile LONG*)value, (LONG)bits);
+#endif
+#ifdef linux
+  return __sync_fetch_and_or(value, bits);
+#endif
+}
+
+unsigned int th_AtomicCompareSwap(volatile unsigned int *value,
+  unsigned int expected, unsigned int desired)
+{
+#ifdef _WIN32
+  return (unsigned int)InterlockedCompareExchange((volatile LONG*)value,
+    (LONG)desired, (LONG)expected);
+#endif
+#ifdef linux
+  return __sync_val_compare_and_swap(value, expected, desired);
+#endif
+}
+
+mutex_t *th_MutexCreate(void)
+{
+  mutex_t *mutex = (mutex_t*)malloc(sizeof(mutex_t));
+
+  if (!mutex) return NULL;
+
+#ifdef _WIN32
+  InitializeCriticalSection(&mutex->section);
+#endif
+#ifdef linux
+  if (pthread_mutex_init(&mutex->handle, NULL))
+  {
+    free(mutex);
+    return NULL;
+  }
+#endif
+
+  return mutex;
+}
+
+void th_MutexDestroy(mutex_t *mutex)
+{
+  if (!mutex) return;
+
+#ifdef _WIN32
+  DeleteCriticalSection(&mutex->section);
+#endif
+#ifdef linux
+  pthread_mutex_destroy(&mutex->handle);
+#endif
+
+  free(mutex);
+}
+
+void th_Lock(mutex_t *mutex)
+{
+#ifdef _WIN32
+  EnterCriticalSection(&mutex->section);
+#endif
+#ifdef linux
+  pthread_mutex_lock(&mutex->handle);
+#endif
+}
+
+void th_Unlock(mutex_t *mutex)
+{
+#ifdef _WIN32
+  LeaveCriticalSection(&mutex->section);
+#endif
+#ifdef linux
+  pthread_mutex_unlock(&mutex->handle);
+#endif
+}
+
+cond_t *th_CondCreate(void)
+{
+  cond_t *cond = (cond_t*)malloc(sizeof(cond_t));
+
+  if (!cond) return NULL;
+
+#ifdef _WIN32
+  InitializeConditionVariable(&cond->handle);
+#endif
+#ifdef linux
+  if (pthread_cond_init(&cond->handle, NULL))
+  {
+    free(cond);
+    return NULL;
+  }
+#endif
+
+  return cond;
+}
+
+void th_CondDestroy(cond_t *cond)
+{
+  if (!cond) return;
+
+#ifdef linux
+  pthread_cond_destroy(&cond->handle);
+#endif
+
+  free(cond);
+}
+
+// can wake up without being signalled, so always wait in a loop
+void th_CondWait(cond_t *cond, mutex_t *mutex)
+{
+#ifdef _WIN32
+  SleepConditionVariableCS(&cond->handle, &mutex->section, INFINITE);
+#endif
+#ifdef linux
+  pthread_cond_wait(&cond->handle, &mutex->handle);
+#endif
+}
+
+void th_CondBroadcast(cond_t *cond)
+{
+#ifdef _WIN32
+  WakeAllConditionVariable(&cond->handle);
+#endif
+#ifdef linux
+  pthread_cond_broadcast(&cond->handle);
+#endif
+}
+
+barrier_t *th_BarrierCreate(int count)
+{
+  barrier_t *barrier = (barrier_t*)malloc(sizeof(barrier_t));
+
+  if (!barrier) return NULL;
+
+  barrier->mutex = th_MutexCreate();
+  barrier->cond = th_CondCreate();
+  if (!barrier->mutex || !barrier->cond)
+  {
+    th_BarrierDestroy(barrier);
+    return NULL;
+  }
+  barrier->count = count;
+  barrier->waiting = 0;
+  barrier->round = 0;
+
+  return barrier;
+}
+
+void th_BarrierDestroy(barrier_t *barrier)
+{
+  if (!barrier) return;
+
+  th_MutexDestroy(barrier->mutex);
+  th_CondDestroy(barrier->cond);
+  free(barrier);
+}
+
+// Rounds are usually short when every thread has its own core, so the
+// waiters spin for a while before they sleep.
+void th_BarrierWait(barrier_t *barrier)
+{
+  int round, spins;
+
+  th_Lock(barrier->mutex);
+  round = th_AtomicGet(&barrier->round);
+  if (++barrier->waiting == barrier->count)
+  {
+    barrier->waiting = 0;
+    th_AtomicIncrement(&barrier->round);
+    th_CondBroadcast(barrier->cond);
+    th_Unlock(barrier->mutex);
+    return;
+  }
+  th_Unlock(barrier->mutex);
+
+  for (spins = 0; spins < TH_BARRIER_SPINS; spins++)
+  {
+    if (th_AtomicGet(&barrier->round) != round) return;
+  }
+
+  th_Lock(barrier->mutex);
+  while (th_AtomicGet(&barrier->round) == round)
+  {
+    th_CondWait(barrier->cond, barrier->mutex);
+  }
+  th_Unlock(barrier->mutex);
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifndef TH_THREADS_H
+#define TH_THREADS_H
+
+typedef void(*th_func_t)(void *arg);
+
+typedef struct thread_s thread_t;
+
+thread_t *th_Create(th_func_t func, void *arg); // returns NULL on failure
+void th_Join(thread_t *thread); // waits for the thread and frees it
+int th_NumCores(void);
+
+int th_AtomicIncrement(volatile int *value); // returns the new value
+int th_AtomicGet(volatile int *value);
+// both return the value from before they changed it
+unsigned int th_AtomicOr(volatile unsigned int *value, unsigned int bits);
+unsigned int th_AtomicCompareSwap(volatile unsigned int *value,
+  unsigned int expected, unsigned int desired); // desired if expected
+
+typedef struct mutex_s mutex_t;
+typedef struct cond_s cond_t;
+
+mutex_t *th_MutexCreate(void); // returns NULL on failure
+void th_MutexDestroy(mutex_t *mutex);
+void th_Lock(mutex_t *mutex);
+void th_Unlock(mutex_t *mutex);
+
+cond_t *th_CondCreate(void); // returns NULL on failure
+void th_CondDestroy(cond_t *cond);
+void th_CondWait(cond_t *cond, mutex_t *mutex); // mutex must be locked
+void th_CondBroadcast(cond_t *cond); // wakes every waiting thread
+
+typedef struct barrier_s barrier_t;
+
+barrier_t *th_BarrierCreate(int count); // returns NULL on failure
+void th_BarrierDestroy(barrier_t *barrier);
+void th_BarrierWait(barrier_t *barrier); // until count threads are waiting
+
+#endif // TH_THREADS_H
\ No newline at end of file